@@ -0,0 +1,386 @@
+#include "latency.hh"
+#include "rendering/screen.hh"
+#include "tty/forkpty.hh"
+#include "tty/ptyreader.hh"
+#include "tty/terminal.hh"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <poll.h>
+#include <random>
+#include <string>
+#include <vector>
+
+// Headless replay benchmark: feeds PTY byte streams through the same
+// termwindow::Write -> Window::Render pipeline as main.out, without SDL
+// and without a child process.
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+struct Stream {
+  std::string name;
+  std::string data;
+};
+
+unsigned width = 129, height = 40;
+constexpr unsigned min_width = 13, min_height = 3; // for GenHtop and GenVim
+unsigned font_width = 8, font_height = 12;
+// Bytes per replayed read, i.e. per frame. Fixed so that runs compare, while
+// PTYReader grows its reads between 4 KiB and 64 KiB.
+std::size_t chunk_size = 16384;
+std::size_t target_size = 16u << 20;
+
+const char *const words[] = {
+    "kernel", "build",  "warning", "linking", "object", "static", "inline",
+    "return", "vector", "string",  "thread",  "socket", "buffer", "render",
+    "parser", "cursor", "window",  "glyph",   "pixel",  "scroll", "memory"};
+
+std::string Word(std::mt19937 &rng) {
+  return words[rng() % std::size(words)];
+}
+
+// A `cat` of a large build log: long plain-text lines, some of them wider
+// than the window so that they wrap.
+std::string GenCat(std::mt19937 &rng) {
+  std::string result;
+  char Buf[64];
+  for (unsigned line = 0; result.size() < target_size; ++line) {
+    result.append(Buf, std::sprintf(Buf, "[%8u.%06u] ", line / 1000,
+                                    unsigned(rng() % 1000000)));
+    for (unsigned n = 3 + rng() % 24; n-- > 0;) {
+      result += Word(rng);
+      result += (rng() % 7) ? ' ' : '/';
+    }
+    result += "\r\n";
+  }
+  return result;
+}
+
+// `htop`-style churn: absolute cursor positioning, colored meters and
+// short numeric fields rewritten in place.
+std::string GenHtop(std::mt19937 &rng) {
+  std::string result = "\33[?25l\33[H\33[2J";
+  char Buf[64];
+  while (result.size() < target_size) {
+    for (unsigned y = 1; y <= 4; ++y) {
+      unsigned fill = rng() % (width - 12);
+      result.append(
+          Buf, std::sprintf(Buf, "\33[%u;3H\33[0;1m%2u\33[0;34m[", y, y));
+      result += "\33[32m";
+      result.append(fill / 2, '|');
+      result += "\33[31m";
+      result.append(fill - fill / 2, '|');
+      result.append(width - 12 - fill, ' ');
+      result.append(Buf, std::sprintf(Buf, "\33[0;1m%3u%%\33[0;34m]",
+                                      unsigned(rng() % 101)));
+    }
+    for (unsigned y = 7; y < height; ++y) {
+      if (rng() % 3)
+        continue;
+      result.append(Buf,
+                    std::sprintf(Buf, "\33[%u;1H\33[0m%6u \33[36m%-8s", y,
+                                 unsigned(rng() % 99999), Word(rng).c_str()));
+      result.append(Buf, std::sprintf(Buf, "\33[0m %5.1f %5.1f ",
+                                      (rng() % 1000) / 10.0,
+                                      (rng() % 1000) / 10.0));
+      result += "\33[1;32m" + Word(rng) + "\33[0m\33[K";
+    }
+    result.append(Buf, std::sprintf(Buf, "\33[%u;1H\33[30;46mF1\33[0mHelp  "
+                                         "\33[30;46mF10\33[0mQuit\33[K",
+                                    height));
+  }
+  return result;
+}
+
+// `vim` scrolling through a file: a scrolling region above a status line,
+// scrolled with LF, RI, SU/SD and IL/DL, with some non-ASCII text.
+std::string GenVim(std::mt19937 &rng) {
+  std::string result = "\33[H\33[2J";
+  char Buf[96];
+  result.append(Buf, std::sprintf(Buf, "\33[1;%ur", height - 2));
+  for (unsigned line = 1; result.size() < target_size; ++line) {
+    switch (rng() % 6) {
+    case 0:
+      result += "\33[H\33M"; // scroll down one line from the top
+      break;
+    case 1:
+      result.append(Buf,
+                    std::sprintf(Buf, "\33[%uS", 1 + unsigned(rng() % 3)));
+      break;
+    case 2:
+      result.append(Buf,
+                    std::sprintf(Buf, "\33[%uT", 1 + unsigned(rng() % 3)));
+      break;
+    case 3:
+      result.append(Buf, std::sprintf(Buf, "\33[%u;1H\33[L",
+                                      1 + unsigned(rng() % (height - 2))));
+      break;
+    case 4:
+      result.append(Buf, std::sprintf(Buf, "\33[%u;1H\33[M",
+                                      1 + unsigned(rng() % (height - 2))));
+      break;
+    default:
+      result.append(Buf, std::sprintf(Buf, "\33[%u;1H\n", height - 2));
+      break;
+    }
+    result.append(Buf, std::sprintf(Buf, "\33[33m%5u \33[0m", line));
+    for (unsigned n = rng() % 10; n-- > 0;)
+      result += (rng() % 9) ? Word(rng) + ' ' : "värikäs 漢字 ─┼─ ";
+    result.append(Buf, std::sprintf(Buf,
+                                    "\33[%u;1H\33[7m src/file.cc [+] %u,1 "
+                                    "\33[K\33[0m",
+                                    height - 1, line));
+  }
+  return result + "\33[r";
+}
+
+// Colored `ls`: a new SGR sequence for nearly every word.
+std::string GenLs(std::mt19937 &rng) {
+  static const char *const colors[] = {"01;34", "01;32", "01;36", "40;33;01",
+                                       "01;35", "00",    "38;5;208",
+                                       "38;2;255;128;0"};
+  std::string result;
+  unsigned column = 0;
+  while (result.size() < target_size) {
+    std::string name = Word(rng) + (rng() % 2 ? ".cc" : "");
+    if (column + name.size() + 2 > width) {
+      result += "\r\n";
+      column = 0;
+    }
+    result += "\33[0m\33[";
+    result += colors[rng() % std::size(colors)];
+    result += 'm' + name + "\33[0m  ";
+    column += name.size() + 2;
+  }
+  return result;
+}
+
+double Percentile(std::vector<double> &values, double p) {
+  if (values.empty())
+    return 0;
+  std::size_t n = std::min(values.size() - 1, std::size_t(values.size() * p));
+  std::nth_element(values.begin(), values.begin() + n, values.end());
+  return values[n];
+}
+
+void Run(const Stream &stream) {
+  Window wnd(width, height);
+  termwindow term(wnd);
+  std::vector<std::uint32_t> pixbuf(width * font_width * height *
+                                    font_height);
+  std::vector<double> frame_times;
+  double parse_time = 0, render_time = 0;
+  std::uint64_t cells_touched = 0, pixels_rendered = 0;
+
+  for (std::size_t pos = 0; pos < stream.data.size(); pos += chunk_size) {
+    std::string_view chunk(stream.data);
+    chunk = chunk.substr(pos, chunk_size);
+
+    auto t0 = Clock::now();
+    term.Write(chunk);
+    auto t1 = Clock::now();
+    for (auto &span : wnd.dirty)
+      if (span.begin < span.end)
+        cells_touched += span.end - span.begin;
+    auto t2 = Clock::now();
+    // Animate as if each frame were shown at 60 Hz, so that the output
+    // does not depend on how fast this machine is
+    double seconds = frame_times.size() / 60.0;
+    for (auto &rect : wnd.Render(font_width, font_height, &pixbuf[0], seconds))
+      pixels_rendered += rect.width * rect.height;
+    auto t3 = Clock::now();
+
+    std::chrono::duration<double> parse = t1 - t0, render = t3 - t2;
+    parse_time += parse.count();
+    render_time += render.count();
+    frame_times.push_back((parse + render).count() * 1e3);
+  }
+
+  // FNV-1a of the last frame, for comparing output across builds
+  std::uint32_t checksum = 2166136261u;
+  for (auto p : pixbuf)
+    checksum = (checksum ^ p) * 16777619u;
+
+  std::printf("%-8s %8.1f %10.1f %8.3f %12llu %14llu %8zu %7.3f %7.3f "
+              "%7.3f %7.3f  %08X\n",
+              stream.name.c_str(), stream.data.size() / 1048576.0,
+              stream.data.size() / 1048576.0 / parse_time, render_time,
+              (unsigned long long)cells_touched,
+              (unsigned long long)pixels_rendered, frame_times.size(),
+              Percentile(frame_times, 0.5), Percentile(frame_times, 0.9),
+              Percentile(frame_times, 0.99),
+              *std::max_element(frame_times.begin(), frame_times.end()),
+              checksum);
+}
+
+// An unchanged screen without reversed cells must not be redrawn, also
+// while the person walks along the top row
+bool CheckIdle() {
+  Window wnd(width, height);
+  termwindow term(wnd);
+  std::vector<std::uint32_t> pixbuf(width * font_width * height *
+                                    font_height);
+  term.Write("$ ls\r\nbench.cc  main.cc\r\n$ ");
+  wnd.Render(font_width, font_height, &pixbuf[0], 0);
+  for (unsigned frame = 1; frame <= 120; ++frame)
+    if (!wnd.Render(font_width, font_height, &pixbuf[0], frame / 60.0)
+             .empty()) {
+      std::fprintf(stderr, "idle: frame %u was redrawn\n", frame);
+      return false;
+    }
+  return true;
+}
+
+// Types keys into a child that echoes them, and measures how long each
+// takes to be rendered, through the same queue, reader and parser as
+// main.out. Rendering stands in for presenting.
+bool RunEcho(unsigned keys) {
+  Window wnd(width, height);
+  termwindow term(wnd);
+  ForkPTY tty(width, height, "stty raw -echo && echo ready && exec cat");
+  PTYReader reader(tty);
+  std::vector<std::uint32_t> pixbuf(width * font_width * height *
+                                    font_height);
+  LatencyTracer latency;
+
+  // Waits for output and parses all of it. Returns false on a timeout.
+  auto Receive = [&]() {
+    struct pollfd p = {reader.getfd(), POLLIN, 0};
+    while (reader.Peek().empty())
+      if (reader.Closed() || poll(&p, 1, 1000) <= 0)
+        return false;
+    reader.Clear();
+    for (std::string_view input; !(input = reader.Peek()).empty();) {
+      term.Write(input);
+      reader.Consume(input.size());
+    }
+    return true;
+  };
+
+  // The echo starts once the terminal settings are in place
+  for (std::string text; text.find("ready") == std::string::npos;) {
+    if (!Receive())
+      break;
+    text.clear();
+    for (std::size_t x = 0; x < wnd.xsize; ++x)
+      text += char(wnd.Row(0)[x].ch);
+  }
+  wnd.Render(font_width, font_height, &pixbuf[0], 0);
+
+  bool ok = true;
+  for (unsigned n = 0; n < keys && ok; ++n) {
+    latency.Input(Clock::now());
+    term.OutBuffer.Push(std::string(1, "abcdefghijklmnopqrstuvwxyz"[n % 26]));
+    term.OutBuffer.Flush(tty.getfd());
+    if (term.OutBuffer.empty())
+      latency.Sent(Clock::now());
+    ok = Receive();
+    latency.Received(reader.LastRead());
+    if (!wnd.Render(font_width, font_height, &pixbuf[0], 0).empty())
+      latency.Presented(Clock::now());
+  }
+
+  tty.Kill(SIGHUP);
+  reader.Stop();
+  tty.Close();
+  if (!ok) {
+    std::fprintf(stderr, "echo: no reply after %zu keys\n", latency.size());
+    return false;
+  }
+  latency.Report(stdout);
+  return true;
+}
+
+void Usage(const char *argv0) {
+  std::fprintf(
+      stderr,
+      "Usage: %s [options] [stream|file]...\n"
+      "Streams: cat htop vim ls (default: all). Any other argument is read\n"
+      "as a file of recorded PTY output, e.g. from script(1).\n"
+      "  -s WxH    window size in cells (default %ux%u)\n"
+      "  -f WxH    font size in pixels (default %ux%u)\n"
+      "  -c BYTES  bytes per read, i.e. per rendered frame (default %zu)\n"
+      "  -m MB     size of each generated stream (default %zu)\n"
+      "  -e KEYS   measure keystroke latency against an echoing child\n",
+      argv0, width, height, font_width, font_height, chunk_size,
+      target_size >> 20);
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  std::vector<std::string> names;
+  unsigned echo_keys = 0;
+  for (int a = 1; a < argc; ++a) {
+    auto Param = [&]() {
+      if (a + 1 >= argc) {
+        Usage(argv[0]);
+        std::exit(1);
+      }
+      return argv[++a];
+    };
+    if (!std::strcmp(argv[a], "-s")) {
+      if (std::sscanf(Param(), "%ux%u", &width, &height) != 2 ||
+          width < min_width || height < min_height) {
+        std::fprintf(stderr, "%s: -s must be at least %ux%u\n", argv[0],
+                     min_width, min_height);
+        return 1;
+      }
+    } else if (!std::strcmp(argv[a], "-f"))
+      std::sscanf(Param(), "%ux%u", &font_width, &font_height);
+    else if (!std::strcmp(argv[a], "-c"))
+      chunk_size = std::max(1l, std::atol(Param()));
+    else if (!std::strcmp(argv[a], "-m"))
+      target_size = std::size_t(std::max(1l, std::atol(Param()))) << 20;
+    else if (!std::strcmp(argv[a], "-e"))
+      echo_keys = std::max(1, std::atoi(Param()));
+    else if (argv[a][0] == '-') {
+      Usage(argv[0]);
+      return 1;
+    } else
+      names.emplace_back(argv[a]);
+  }
+  if (!CheckIdle())
+    return 1;
+  if (echo_keys) {
+    if (!RunEcho(echo_keys))
+      return 1;
+    if (names.empty())
+      return 0;
+    std::printf("\n");
+  }
+  if (names.empty())
+    names = {"cat", "htop", "vim", "ls"};
+
+  std::printf("%-8s %8s %10s %8s %12s %14s %8s %7s %7s %7s %7s  %s\n",
+              "stream", "MB", "MB/s", "render s", "cells", "pixels", "frames",
+              "p50 ms", "p90 ms", "p99 ms", "max ms", "checksum");
+
+  for (auto &name : names) {
+    std::mt19937 rng(12345);
+    Stream s{name, {}};
+    if (name == "cat")
+      s.data = GenCat(rng);
+    else if (name == "htop")
+      s.data = GenHtop(rng);
+    else if (name == "vim")
+      s.data = GenVim(rng);
+    else if (name == "ls")
+      s.data = GenLs(rng);
+    else {
+      std::ifstream f(name, std::ios::binary);
+      if (!f) {
+        std::fprintf(stderr, "%s: cannot open\n", name.c_str());
+        return 1;
+      }
+      s.data.assign(std::istreambuf_iterator<char>(f), {});
+    }
+    if (!s.data.empty())
+      Run(s);
+  }
+}
@@ -1,60 +1,202 @@
 #include "ctype.hh"
+#include <algorithm>
 
-std::u32string FromUTF8(std::string_view s) {
-  std::u32string result;
-  unsigned cache = 0;
-  constexpr unsigned bytes_left_shift = 2,
-                     bytes_left_mask = (1u << bytes_left_shift) - 1;
-  constexpr unsigned con = 0b00000000000000000101010101011011u;
-
-  for (unsigned char c : s) {
-    unsigned c0 = (cache & bytes_left_mask);
-    unsigned c1 = (((cache >> bytes_left_shift) * 0x40u + (c & 0x3F))
-                   << bytes_left_shift) +
-                  (c0 - 1);
-    unsigned c2 = ((con << ((c >> 4) * 2)) & 0xFFFFFFFFu) >> 30;
-    c2 += ((c & (0x70F1F7Fu >> (c2 * 8))) << bytes_left_shift);
-    cache = c0 ? c1 : c2;
-
-    if (!(cache & bytes_left_mask)) {
-      char32_t c = cache >> bytes_left_shift;
-      if (__builtin_expect(result.empty(), false) ||
-          __builtin_expect(c < 0xDC00 || c > 0xDFFF, true) ||
-          __builtin_expect(result.back() < 0xD800 || result.back() > 0xDBFF,
-                           false))
-        result += c;
-      else
-        result.back() =
-            (result.back() - 0xD800u) * 0x400u + (c - 0xDC00u) + 0x10000u;
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Decodes one multibyte sequence, rejecting overlongs, surrogates and
+// values above U+10FFFF. Returns its length (the length of the maximal
+// valid prefix for malformed input), or 0 if s ends in the middle of it.
+static std::size_t DecodeSequence(const unsigned char *s, std::size_t avail,
+                                  char32_t &result) {
+  unsigned char c = s[0], lo = 0x80, hi = 0xBF;
+  unsigned length;
+  if (c >= 0xC2 && c <= 0xDF)
+    length = 2;
+  else if (c >= 0xE0 && c <= 0xEF) {
+    length = 3;
+    if (c == 0xE0)
+      lo = 0xA0;
+    if (c == 0xED)
+      hi = 0x9F;
+  } else if (c >= 0xF0 && c <= 0xF4) {
+    length = 4;
+    if (c == 0xF0)
+      lo = 0x90;
+    if (c == 0xF4)
+      hi = 0x8F;
+  } else {
+    result = U'\uFFFD';
+    return 1;
+  }
+
+  char32_t value = c & (0x7F >> length);
+  for (unsigned n = 1; n < length; ++n) {
+    if (n >= avail)
+      return 0;
+    if (s[n] < lo || s[n] > hi) {
+      result = U'\uFFFD';
+      return n;
+    }
+    lo = 0x80;
+    hi = 0xBF;
+    value = (value << 6) + (s[n] & 0x3F);
+  }
+  result = value;
+  return length;
+}
+
+UTF8Decoded FromUTF8(std::string_view s, char32_t *out) {
+  auto *in = reinterpret_cast<const unsigned char *>(s.data());
+  std::size_t length = s.size(), pos = 0, produced = 0;
+
+  while (pos < length) {
+    // ASCII fast path: widen whole vectors of 7-bit bytes.
+#if defined(__AVX2__)
+    for (; pos + 32 <= length; pos += 32, produced += 32) {
+      __m256i v = _mm256_loadu_si256((const __m256i *)(in + pos));
+      if (_mm256_movemask_epi8(v))
+        break;
+      for (unsigned n = 0; n < 32; n += 8) {
+        __m128i bytes = _mm_loadl_epi64((const __m128i *)(in + pos + n));
+        _mm256_storeu_si256((__m256i *)(out + produced + n),
+                            _mm256_cvtepu8_epi32(bytes));
+      }
+    }
+#endif
+#if defined(__SSE2__)
+    for (; pos + 16 <= length; pos += 16, produced += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(in + pos));
+      if (_mm_movemask_epi8(v))
+        break;
+      __m128i zero = _mm_setzero_si128();
+      __m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+      auto *o = reinterpret_cast<__m128i *>(out + produced);
+      _mm_storeu_si128(o + 0, _mm_unpacklo_epi16(lo, zero));
+      _mm_storeu_si128(o + 1, _mm_unpackhi_epi16(lo, zero));
+      _mm_storeu_si128(o + 2, _mm_unpacklo_epi16(hi, zero));
+      _mm_storeu_si128(o + 3, _mm_unpackhi_epi16(hi, zero));
+    }
+#endif
+    while (pos < length && in[pos] < 0x80)
+      out[produced++] = in[pos++];
+    if (pos == length)
+      break;
+
+    std::size_t n = DecodeSequence(in + pos, length - pos, out[produced]);
+    if (!n)
+      break;
+    pos += n;
+    ++produced;
+  }
+
+  return {pos, produced};
+}
+
+std::size_t UTF8Decoder::Decode(std::string_view s, char32_t *out) {
+  std::size_t produced = 0;
+  if (pending_length && !s.empty()) {
+    // Finish the sequence left over from the previous chunk
+    unsigned char buf[4];
+    std::size_t take = std::min(s.size(), std::size_t(4 - pending_length));
+    std::copy_n(pending, pending_length, buf);
+    std::copy_n(s.data(), take, buf + pending_length);
+
+    std::size_t n = DecodeSequence(buf, pending_length + take, out[0]);
+    if (!n) {
+      // Still incomplete; all of s went into it
+      std::copy_n(buf + pending_length, take, pending + pending_length);
+      pending_length += take;
+      return 0;
     }
+    ++produced;
+    s.remove_prefix(n - pending_length);
+    pending_length = 0;
   }
 
+  auto r = FromUTF8(s, out + produced);
+  std::copy(s.begin() + r.consumed, s.end(), pending);
+  pending_length = s.size() - r.consumed;
+  return produced + r.produced;
+}
+
+std::u32string FromUTF8(std::string_view s) {
+  std::u32string result(s.size(), U'\0');
+  auto r = FromUTF8(s, result.data());
+  if (r.consumed < s.size())
+    result[r.produced++] = U'\uFFFD'; // Truncated at the end
+  result.resize(r.produced);
   return result;
 }
 
-std::string ToUTF8(std::u32string_view s) {
-  std::string result;
-  alignas(16) static constexpr unsigned S[4] = {0x7F, 0x3F, 0x3F, 0x3F},
-                                        q[4] = {0xFF, 0, 0, 0},
-                                        o[4] = {0, 0x80, 0x80, 0x80};
-
-  for (char32_t c : s) {
-    unsigned n = (c >= 0x80u) + (c >= 0x800u) + (c >= 0x10000u);
-    unsigned val = 0xF0E0C000u >> (n * 8u);
-    alignas(16) unsigned w[4] = {val, val, val, val};
-#pragma omp simd
-    for (unsigned m = 0; m < 4; ++m)
-      w[m] = ((w[m] & q[m]) + ((c >> ((n - m) * 6u) & S[m]) + o[m]))
-             << (m * 8u);
-    unsigned sum = 0;
-#pragma omp simd
-    for (unsigned m = 0; m < 4; ++m)
-      sum += w[m];
-    alignas(4) char temp[4];
-    for (unsigned m = 0; m < 4; ++m)
-      temp[m] = sum >> (m * 8);
-    result.append(temp, n + 1);
+std::size_t ToUTF8(std::u32string_view s, char *out) {
+  const char32_t *in = s.data();
+  std::size_t length = s.size(), pos = 0;
+  char *o = out;
+
+  while (pos < length) {
+    // ASCII fast path: narrow 16 codepoints at a time.
+#if defined(__AVX2__)
+    for (const __m256i high = _mm256_set1_epi32(~0x7F); pos + 16 <= length;
+         pos += 16, o += 16) {
+      __m256i a = _mm256_loadu_si256((const __m256i *)(in + pos));
+      __m256i b = _mm256_loadu_si256((const __m256i *)(in + pos + 8));
+      if (!_mm256_testz_si256(_mm256_or_si256(a, b), high))
+        break;
+      // packus works within 128-bit lanes: restore the order afterwards
+      __m256i w = _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b),
+                                           0b11011000);
+      _mm_storeu_si128((__m128i *)o,
+                       _mm_packus_epi16(_mm256_castsi256_si128(w),
+                                        _mm256_extracti128_si256(w, 1)));
+    }
+#elif defined(__SSE2__)
+    for (const __m128i high = _mm_set1_epi32(~0x7F); pos + 16 <= length;
+         pos += 16, o += 16) {
+      auto *v = reinterpret_cast<const __m128i *>(in + pos);
+      __m128i a = _mm_loadu_si128(v + 0), b = _mm_loadu_si128(v + 1),
+              c = _mm_loadu_si128(v + 2), d = _mm_loadu_si128(v + 3);
+      __m128i any = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+      if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(any, high),
+                                            _mm_setzero_si128())) != 0xFFFF)
+        break;
+      _mm_storeu_si128((__m128i *)o,
+                       _mm_packus_epi16(_mm_packs_epi32(a, b),
+                                        _mm_packs_epi32(c, d)));
+    }
+#endif
+    // Scalar: up to the end of the vector that did not qualify.
+    for (std::size_t end = std::min(length, pos + 16); pos < end; ++pos) {
+      char32_t c = in[pos];
+      if (c < 0x80) {
+        *o++ = c;
+      } else if (c < 0x800) {
+        o[0] = 0xC0 | (c >> 6);
+        o[1] = 0x80 | (c & 0x3F);
+        o += 2;
+      } else if (c < 0x10000) {
+        o[0] = 0xE0 | (c >> 12);
+        o[1] = 0x80 | ((c >> 6) & 0x3F);
+        o[2] = 0x80 | (c & 0x3F);
+        o += 3;
+      } else {
+        o[0] = 0xF0 | ((c >> 18) & 0x07);
+        o[1] = 0x80 | ((c >> 12) & 0x3F);
+        o[2] = 0x80 | ((c >> 6) & 0x3F);
+        o[3] = 0x80 | (c & 0x3F);
+        o += 4;
+      }
+    }
   }
 
+  return o - out;
+}
+
+std::string ToUTF8(std::u32string_view s) {
+  std::string result(s.size() * 4, '\0');
+  result.resize(ToUTF8(s, result.data()));
   return result;
 }
@@ -6,4 +6,33 @@
 std::u32string FromUTF8(std::string_view s);
 std::string ToUTF8(std::u32string_view s);
 
+struct UTF8Decoded {
+  std::size_t consumed; // bytes of input used
+  std::size_t produced; // codepoints written
+};
+
+// Decodes s into out, which must have room for s.size() codepoints.
+// Malformed input becomes U+FFFD. A sequence that is cut short by the end
+// of s is left unconsumed, so that it can be completed by the next chunk.
+UTF8Decoded FromUTF8(std::string_view s, char32_t *out);
+
+// Encodes s into out, which must have room for 4 * s.size() bytes.
+// Returns the number of bytes written.
+std::size_t ToUTF8(std::u32string_view s, char *out);
+
+// Incremental decoder for a byte stream that arrives in arbitrary chunks,
+// such as PTY reads: a sequence split between two chunks is carried over.
+class UTF8Decoder {
+public:
+  // out must have room for s.size() + 1 codepoints.
+  // Returns the number of codepoints written.
+  std::size_t Decode(std::string_view s, char32_t *out);
+
+  bool Pending() const { return pending_length; }
+
+private:
+  unsigned char pending[4];
+  unsigned pending_length = 0;
+};
+
 #endif /* CTYPE_H */
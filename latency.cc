@@ -0,0 +1,58 @@
+#include "latency.hh"
+#include <algorithm>
+
+static double Milliseconds(LatencyTracer::Clock::duration d) {
+  return std::chrono::duration<double, std::milli>(d).count();
+}
+
+static double Percentile(std::vector<double> &values, double p) {
+  if (values.empty())
+    return 0;
+  std::size_t n = std::min(values.size() - 1, std::size_t(values.size() * p));
+  std::nth_element(values.begin(), values.begin() + n, values.end());
+  return values[n];
+}
+
+void LatencyTracer::Input(Clock::time_point when) {
+  pending.push_back({when, {}, {}});
+}
+
+void LatencyTracer::Sent(Clock::time_point when) {
+  for (; sent < pending.size(); ++sent) {
+    pending[sent].sent = when;
+    to_sent.push_back(Milliseconds(when - pending[sent].input));
+  }
+}
+
+void LatencyTracer::Received(Clock::time_point when) {
+  // Output read before an input was written cannot be its echo
+  for (; received < sent && pending[received].sent <= when; ++received) {
+    pending[received].received = when;
+    to_received.push_back(Milliseconds(when - pending[received].sent));
+  }
+}
+
+void LatencyTracer::Presented(Clock::time_point when) {
+  for (; received > 0; --received, --sent) {
+    const Trace &t = pending.front();
+    to_presented.push_back(Milliseconds(when - t.received));
+    totals.push_back(Milliseconds(when - t.input));
+    pending.pop_front();
+  }
+}
+
+void LatencyTracer::Report(std::FILE *out) {
+  std::fprintf(out, "%-16s %8s %8s %8s %8s\n", "latency", "count", "p50 ms",
+               "p99 ms", "max ms");
+  auto Line = [&](const char *name, std::vector<double> &values) {
+    std::fprintf(out, "%-16s %8zu %8.3f %8.3f %8.3f\n", name, values.size(),
+                 Percentile(values, 0.5), Percentile(values, 0.99),
+                 values.empty()
+                     ? 0
+                     : *std::max_element(values.begin(), values.end()));
+  };
+  Line("input->sent", to_sent);
+  Line("sent->echo", to_received);
+  Line("echo->present", to_presented);
+  Line("input->present", totals);
+}
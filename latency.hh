@@ -0,0 +1,40 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <vector>
+
+// Measures how long keystrokes take to show up on screen: from the input
+// event, to being written to the PTY, to the echo being read back, to the
+// first frame that is presented after the echo has been parsed.
+//
+// Each input is tagged when it happens, and advances through the stages
+// in order. All inputs waiting at a stage advance together, since the
+// terminal cannot tell which output echoes which keystroke.
+class LatencyTracer {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  void Input(Clock::time_point when);
+  void Sent(Clock::time_point when);     // everything queued was written
+  void Received(Clock::time_point when); // output was read and parsed
+  void Presented(Clock::time_point when); // a frame with damage was shown
+
+  std::size_t size() const { return totals.size(); } // complete inputs
+
+  // Prints p50, p99 and the maximum of each stage, in milliseconds
+  void Report(std::FILE *out);
+
+private:
+  struct Trace {
+    Clock::time_point input, sent, received;
+  };
+
+  std::deque<Trace> pending; // oldest first
+  std::size_t sent = 0, received = 0; // of pending, how many got that far
+  std::vector<double> to_sent, to_received, to_presented, totals;
+};
+
+#endif /* LATENCY_H */
@@ -1,12 +1,22 @@
 #include "ctype.hh"
+#include "latency.hh"
 #include "rendering/screen.hh"
+#include "tty/eventfd.hh"
 #include "tty/forkpty.hh"
+#include "tty/ptyreader.hh"
 #include "tty/terminal.hh"
 #include <SDL.h>
+#include <SDL_syswm.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
 #include <cstdint>
 #include <cstdio>
-#include <poll.h>
-#include <sys/poll.h>
+#include <cstring>
+#include <optional>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 #include <unordered_map>
 #include <vector>
@@ -26,6 +36,18 @@ unsigned cells_vert, cell_height_pixels, pixels_height, bufpixels_height,
     textureheight;
 std::vector<std::uint32_t> pixbuf;
 
+using Clock = std::chrono::steady_clock;
+// How long SDL events may wait, when there is no fd to wait for them on
+constexpr auto input_latency = std::chrono::milliseconds(30);
+
+// Statistics, updated every stats_interval. The overlay is drawn by a
+// Window of its own over the top right corner, and toggled with Ctrl+F12.
+constexpr auto stats_interval = std::chrono::seconds(1);
+std::uint64_t texture_bytes = 0, render_copies = 0;
+bool overlay_visible = false, overlay_changed = false;
+SDL_Texture *overlay_texture = nullptr;
+std::vector<std::uint32_t> overlay_pixels;
+
 void SDL_ReInitialize(unsigned cells_horizontal, unsigned cells_vertial) {
   cells_horiz = cells_horizontal;
   cells_vert = cells_vertial;
@@ -70,102 +92,340 @@ void SDL_ReInitialize(unsigned cells_horizontal, unsigned cells_vertial) {
   pixbuf.resize(bufpixels_width * bufpixels_height);
 }
 
-void SDL_ReDraw(Window &wnd) {
-  SDL_Rect rect;
-  rect.x = 0;
-  rect.w = bufpixels_width;
-  rect.y = 0;
-  rect.h = 0;
-  unsigned errors = 0;
-
-  auto RenderFlushLines = [&]() {
-    if (rect.h) {
-      int w, h;
-      SDL_GetWindowSize(window, &w, &h);
-
-      SDL_Rect trect;
-      trect.x = rect.x * w / bufpixels_width;
-      trect.y = rect.y * h / bufpixels_height;
-      trect.w = (rect.x + rect.w) * w / bufpixels_width - trect.x;
-      trect.h = (rect.y + rect.h) * h / bufpixels_height - trect.y;
-
-      if (SDL_UpdateTexture(texture, &rect,
-                            pixbuf.data() + rect.y * bufpixels_width,
-                            bufpixels_width * sizeof(pixbuf[0])))
-        ++errors;
-      if (SDL_RenderCopy(renderer, texture, &rect, &trect))
-        ++errors;
-
-      rect.y += rect.h;
-      rect.h = 0;
-    }
-  };
+// The refresh period of the display that the window is on
+Clock::duration FrameInterval() {
+  SDL_DisplayMode mode;
+  int hz = 60;
+  if (!SDL_GetWindowDisplayMode(window, &mode) && mode.refresh_rate > 0)
+    hz = mode.refresh_rate;
+  return std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(1.0 / hz));
+}
 
-  auto RenderAddLine = [&](unsigned line) {
-    if (line > rect.y + rect.h + 15 || line < rect.y)
-      RenderFlushLines();
-    if (!rect.h) {
-      rect.y = line;
-      rect.h = 1;
-    } else {
-      rect.h = line + 1 - rect.y;
-    }
-  };
+// The fd of the X11 connection, which becomes readable when input events
+// arrive; these are only queued by SDL when the main thread pumps events.
+// Returns -1 for other video drivers.
+int InputFd() {
+#if defined(SDL_VIDEO_DRIVER_X11)
+  SDL_SysWMinfo info;
+  SDL_VERSION(&info.version);
+  if (SDL_GetWindowWMInfo(window, &info) && info.subsystem == SDL_SYSWM_X11)
+    return ConnectionNumber(info.info.x11.display);
+#endif
+  return -1;
+}
 
-  wnd.Render(VidCellWidth, VidCellHeight, &pixbuf[0]);
+// Signals the eventfd in userdata for every event that SDL queues, also
+// from other threads
+int WatchEvent(void *userdata, SDL_Event *event) {
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+  // SDL_PollEvent queues one of these on every call; signalling it would
+  // wake the loop again right away, forever.
+  if (event->type == SDL_POLLSENTINEL)
+    return 0;
+#else
+  (void)event;
+#endif
+  SignalEventFD(*static_cast<int *>(userdata));
+  return 0;
+}
 
-  for (unsigned y = 0; y < cells_vert * VidCellHeight; ++y)
-    RenderAddLine(y);
+void Watch(int epfd, int fd, std::uint32_t events) {
+  struct epoll_event ev = {};
+  ev.events = events;
+  ev.data.fd = fd;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
 
-  RenderFlushLines();
+// When an SDL event with this timestamp happened
+Clock::time_point EventTime(Uint32 timestamp) {
+  return Clock::now() - std::chrono::milliseconds(SDL_GetTicks() - timestamp);
+}
 
-  if (rect.y) {
-    SDL_RenderPresent(renderer);
+// Returns whether a frame was presented
+bool SDL_ReDraw(Window &wnd, Window &overlay) {
+  auto &damage = wnd.Render(VidCellWidth, VidCellHeight, &pixbuf[0]);
+
+  int overlay_width = overlay.xsize * VidCellWidth;
+  int overlay_height = overlay.ysize * VidCellHeight;
+  if (overlay_visible &&
+      overlay_pixels.size() != std::size_t(overlay_width) * overlay_height) {
+    if (overlay_texture)
+      SDL_DestroyTexture(overlay_texture);
+    overlay_texture = SDL_CreateTexture(
+        renderer, SDL_PIXELFORMAT_BGRA32, SDL_TEXTUREACCESS_STREAMING,
+        overlay_width, overlay_height);
+    overlay_pixels.assign(overlay_width * overlay_height, 0);
+    overlay.Dirtify();
+    overlay_changed = true;
   }
+  if (overlay_visible && overlay_changed) {
+    overlay.Render(VidCellWidth, VidCellHeight, overlay_pixels.data());
+    SDL_UpdateTexture(overlay_texture, nullptr, overlay_pixels.data(),
+                      overlay_width * sizeof(overlay_pixels[0]));
+    texture_bytes += overlay_pixels.size() * sizeof(overlay_pixels[0]);
+  }
+  if (damage.empty() && !(overlay_visible && overlay_changed))
+    return false;
+  overlay_changed = false;
+
+  // Uploading a rectangle has a fixed cost, so nearby ones are merged when
+  // that adds no more than a row of cells worth of clean pixels.
+  std::size_t slack = bufpixels_width * VidCellHeight;
+  std::vector<SDL_Rect> uploads;
+  std::size_t area = 0; // of the rects merged into uploads.back()
+  for (auto &r : damage) {
+    SDL_Rect rect{int(r.x), int(r.y), int(r.width), int(r.height)};
+    if (!uploads.empty()) {
+      SDL_Rect &last = uploads.back();
+      int x1 = std::min(last.x, rect.x), y1 = std::min(last.y, rect.y);
+      int x2 = std::max(last.x + last.w, rect.x + rect.w);
+      int y2 = std::max(last.y + last.h, rect.y + rect.h);
+      std::size_t merged = std::size_t(x2 - x1) * (y2 - y1);
+      area += std::size_t(rect.w) * rect.h;
+      if (merged <= area + slack) {
+        last = {x1, y1, x2 - x1, y2 - y1};
+        continue;
+      }
+    }
+    uploads.push_back(rect);
+    area = std::size_t(rect.w) * rect.h;
+  }
+
+  for (auto &rect : uploads) {
+    SDL_UpdateTexture(texture, &rect,
+                      pixbuf.data() + rect.y * bufpixels_width + rect.x,
+                      bufpixels_width * sizeof(pixbuf[0]));
+    texture_bytes += rect.w * rect.h * sizeof(pixbuf[0]);
+  }
+
+  // The back buffer is undefined after SDL_RenderPresent, so the whole
+  // texture is copied; only the damaged parts of it were uploaded.
+  SDL_Rect source{0, 0, int(bufpixels_width), int(bufpixels_height)};
+  SDL_RenderCopy(renderer, texture, &source, nullptr);
+  ++render_copies;
+  if (overlay_visible) {
+    int w, h;
+    SDL_GetWindowSize(window, &w, &h);
+    int buf_width = bufpixels_width, buf_height = bufpixels_height;
+    SDL_Rect target;
+    target.x = (buf_width - overlay_width) * w / buf_width;
+    target.y = 0;
+    target.w = w - target.x;
+    target.h = overlay_height * h / buf_height;
+    SDL_RenderCopy(renderer, overlay_texture, nullptr, &target);
+    ++render_copies;
+  }
+  SDL_RenderPresent(renderer);
+  return true;
 }
 } // namespace
 
-int main() {
+int main(int argc, char **argv) {
+  std::optional<LatencyTracer> latency;
+  int stats_fd = -1; // where to write the statistics every stats_interval
+  long scrollback_mb = -1, spill_mb = 0;
+  const char *spill_dir = nullptr;
+  for (int a = 1; a < argc; ++a) {
+    if (!std::strcmp(argv[a], "--latency"))
+      latency.emplace();
+    else if (!std::strcmp(argv[a], "--stats") && a + 1 < argc)
+      stats_fd = std::atoi(argv[++a]);
+    else if (!std::strcmp(argv[a], "--scrollback") && a + 1 < argc)
+      scrollback_mb = std::max(0l, std::atol(argv[++a]));
+    else if (!std::strcmp(argv[a], "--spill") && a + 2 < argc) {
+      spill_dir = argv[++a];
+      spill_mb = std::max(0l, std::atol(argv[++a]));
+    }
+  }
+
   Window wnd(WindowWidth, WindowHeight);
+  if (scrollback_mb >= 0)
+    wnd.scrollback.SetMemoryBudget(std::size_t(scrollback_mb) << 20);
+  if (spill_dir &&
+      !wnd.scrollback.EnableSpill(spill_dir, std::size_t(spill_mb) << 20))
+    fprintf(stderr, "%s: cannot create the scrollback file\n", spill_dir);
   termwindow term(wnd);
   ForkPTY tty(wnd.xsize, wnd.ysize);
-  std::string outbuffer;
+  PTYReader reader(tty);
+  Window overlay(40, 8);
+  overlay.blank.fgcolor = 0xFFFFFF;
+  overlay.blank.bgcolor = 0x000060;
 
   SDL_ReInitialize(wnd.xsize, wnd.ysize);
   SDL_StartTextInput();
 
   std::unordered_map<int, bool> keys;
   bool quit = false;
+  bool wnd_changed = true; // since the last frame
 
-  while (!quit) {
-    struct pollfd p[2] = {{tty.getfd(), POLLIN, 0}};
-    if (!term.OutBuffer.empty() || !outbuffer.empty()) {
-      p[0].events |= POLLOUT;
+  Clock::duration frame_interval = FrameInterval();
+  Clock::time_point next_frame = Clock::now();
+  Clock::time_point next_stats = next_frame + stats_interval;
+
+  // Running totals, at the last statistics update
+  struct Totals {
+    std::uint64_t bytes_read, reads, chars_parsed, cells_put, cells_changed,
+        cells_rendered, pixels_rendered, frames, texture_bytes, copies;
+  };
+  auto Sample = [&]() {
+    return Totals{reader.BytesRead(),         reader.Reads(),
+                  term.chars_parsed,          wnd.counters.cells_put,
+                  wnd.counters.cells_changed, wnd.counters.cells_rendered,
+                  wnd.counters.pixels_rendered, wnd.counters.frames,
+                  texture_bytes,              render_copies};
+  };
+  Totals last = Sample();
+  Clock::time_point last_time = Clock::now();
+
+  auto UpdateStats = [&](Clock::time_point now) {
+    Totals t = Sample();
+    if (stats_fd >= 0)
+      dprintf(stats_fd,
+              "read=%llu reads=%llu parsed=%llu put=%llu changed=%llu "
+              "rendered=%llu pixels=%llu frames=%llu uploaded=%llu "
+              "copies=%llu scrollback=%zu scrollback_memory=%zu "
+              "scrollback_file=%zu\n",
+              (unsigned long long)t.bytes_read, (unsigned long long)t.reads,
+              (unsigned long long)t.chars_parsed,
+              (unsigned long long)t.cells_put,
+              (unsigned long long)t.cells_changed,
+              (unsigned long long)t.cells_rendered,
+              (unsigned long long)t.pixels_rendered,
+              (unsigned long long)t.frames,
+              (unsigned long long)t.texture_bytes,
+              (unsigned long long)t.copies, wnd.scrollback.size(),
+              wnd.scrollback.MemoryUsed(), wnd.scrollback.FileUsed());
+
+    if (overlay_visible) {
+      double s = std::chrono::duration<double>(now - last_time).count();
+      auto Rate = [&](std::uint64_t Totals::*field) {
+        return s > 0 ? (t.*field - last.*field) / s : 0;
+      };
+      auto Ratio = [&](std::uint64_t Totals::*a, std::uint64_t Totals::*b) {
+        return t.*b != last.*b ? double(t.*a - last.*a) / (t.*b - last.*b)
+                                : 0;
+      };
+      char Buf[8][64];
+      std::snprintf(Buf[0], 64, "read    %9.0f KiB/s %6.0f B/read",
+                    Rate(&Totals::bytes_read) / 1024,
+                    Ratio(&Totals::bytes_read, &Totals::reads));
+      std::snprintf(Buf[1], 64, "parse   %9.0f chars/s",
+                    Rate(&Totals::chars_parsed));
+      std::snprintf(Buf[2], 64, "put     %9.0f cells/s %5.1f%% new",
+                    Rate(&Totals::cells_put),
+                    100 * Ratio(&Totals::cells_changed, &Totals::cells_put));
+      std::snprintf(Buf[3], 64, "render  %9.0f cells/s %5.0f fps",
+                    Rate(&Totals::cells_rendered), Rate(&Totals::frames));
+      std::snprintf(Buf[4], 64, "        %9.0f Kpix/s",
+                    Rate(&Totals::pixels_rendered) / 1000);
+      std::snprintf(Buf[5], 64, "upload  %9.0f KiB/s %5.0f copies/s",
+                    Rate(&Totals::texture_bytes) / 1024,
+                    Rate(&Totals::copies));
+      std::snprintf(Buf[6], 64, "ring    %9zu KiB %7zu stalls",
+                    reader.Occupancy() >> 10, reader.Stalls());
+      std::snprintf(Buf[7], 64, "output  %9zu bytes queued",
+                    term.OutBuffer.size());
+      for (unsigned y = 0; y < overlay.ysize; ++y) {
+        std::string line = Buf[y];
+        line.resize(overlay.xsize, ' ');
+        overlay.PutText(0, y, line.data(), line.size());
+      }
+      overlay_changed = true;
     }
+    last = t;
+    last_time = now;
+  };
 
-    int pollres = poll(p, 1, 30);
-    if (pollres < 0)
-      break;
+  // Everything that can wake the loop: PTY input, SDL events, the frame
+  // timer, and the PTY becoming writable while output is blocked.
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  int event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  int input_fd = InputFd();
+  Watch(epfd, reader.getfd(), EPOLLIN);
+  Watch(epfd, event_fd, EPOLLIN);
+  Watch(epfd, timer_fd, EPOLLIN);
+  if (input_fd >= 0)
+    Watch(epfd, input_fd, EPOLLIN);
+  SDL_AddEventWatch(WatchEvent, &event_fd);
+  bool sending = false; // whether the PTY is watched for EPOLLOUT
+  Uint32 pending_time = 0; // of the key that pending_input is for
+
+  auto Flush = [&]() {
+    term.OutBuffer.Flush(tty.getfd());
+    if (latency && term.OutBuffer.empty())
+      latency->Sent(Clock::now());
+  };
+  Clock::time_point timer{};
 
-    if (p[0].revents & POLLIN) {
-      auto input = tty.Recv();
-      auto &str = input.first;
-      term.Write(FromUTF8(str));
+  while (!quit) {
+    // The frame timer runs while there is something to show
+    Clock::time_point wakeup{};
+    if (wnd_changed || wnd.Animating())
+      wakeup = next_frame;
+    if ((overlay_visible || stats_fd >= 0) &&
+        (wakeup == Clock::time_point{} || next_stats < wakeup))
+      wakeup = next_stats;
+    if (wakeup != timer) {
+      auto since_epoch = std::chrono::duration_cast<std::chrono::nanoseconds>(
+          wakeup.time_since_epoch());
+      struct itimerspec spec = {};
+      spec.it_value.tv_sec = since_epoch.count() / 1000000000;
+      spec.it_value.tv_nsec = since_epoch.count() % 1000000000;
+      if (wakeup != Clock::time_point{} && !spec.it_value.tv_sec &&
+          !spec.it_value.tv_nsec)
+        spec.it_value.tv_nsec = 1;
+      timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+      timer = wakeup;
     }
 
-    if (p[0].revents & (POLLERR | POLLHUP)) {
-      quit = true;
+    bool blocked = term.OutBuffer.Blocked() && !term.OutBuffer.empty();
+    if (blocked != sending) {
+      struct epoll_event ev = {};
+      ev.events = EPOLLOUT;
+      ev.data.fd = tty.getfd();
+      epoll_ctl(epfd, blocked ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, tty.getfd(),
+                &ev);
+      sending = blocked;
+    }
+
+    int timeout = -1;
+    if (!reader.Peek().empty())
+      timeout = 0;
+    else if (input_fd < 0)
+      timeout = input_latency.count();
+
+    struct epoll_event events[8];
+    int count = epoll_wait(epfd, events, std::size(events), timeout);
+    if (count < 0 && errno != EINTR)
+      break;
+    for (int n = 0; n < count; ++n) {
+      int fd = events[n].data.fd;
+      if (fd == reader.getfd())
+        reader.Clear();
+      else if (fd == event_fd || fd == timer_fd)
+        DrainEventFD(fd);
+      else if (fd == tty.getfd())
+        Flush();
     }
 
-    if (!term.OutBuffer.empty()) {
-      std::u32string str(term.OutBuffer.begin(), term.OutBuffer.end());
-      outbuffer += ToUTF8(str);
+    // Parse for at most part of a frame, so that a flood of output can
+    // neither delay the next frame nor the handling of input events.
+    auto deadline = Clock::now() + frame_interval / 2;
+    bool parsed = false;
+    for (std::string_view input;
+         !(input = reader.Peek()).empty() && Clock::now() < deadline;) {
+      input = input.substr(0, 65536);
+      term.Write(input);
+      reader.Consume(input.size());
+      wnd_changed = parsed = true;
     }
+    if (latency && parsed)
+      latency->Received(reader.LastRead());
 
-    if (!outbuffer.empty()) {
-      int r = tty.Send(outbuffer);
-      if (r > 0)
-        outbuffer.erase(0, r);
+    if (reader.Closed() && reader.Peek().empty()) {
+      quit = true;
     }
 
     std::string pending_input;
@@ -178,6 +438,9 @@ int main() {
         case SDL_WINDOWEVENT_RESIZED:
         case SDL_WINDOWEVENT_SIZE_CHANGED:
           wnd.Dirtify();
+          wnd_changed = true;
+          // The window may have moved to another display
+          frame_interval = FrameInterval();
           break;
         default:
           break;
@@ -189,12 +452,15 @@ int main() {
       case SDL_TEXTINPUT:
         // fix: type one '.' then terminal show two '.'s
         pending_input.clear();
-        tty.Send(ev.text.text);
+        term.OutBuffer.Push(ev.text.text);
+        if (latency)
+          latency->Input(EventTime(ev.text.timestamp));
         break;
       case SDL_KEYDOWN:
       case SDL_KEYUP: {
         keys[ev.key.keysym.sym] = (ev.type == SDL_KEYDOWN);
         if (ev.type == SDL_KEYDOWN) {
+          pending_time = ev.key.timestamp;
           static const std::unordered_map<int, std::pair<int, char>> lore{
               {SDLK_F1, {1, 'P'}},   {SDLK_LEFT, {1, 'D'}},
               {SDLK_F2, {1, 'Q'}},   {SDLK_RIGHT, {1, 'C'}},
@@ -306,6 +572,16 @@ int main() {
             SDL_ReInitialize(wnd.xsize, wnd.ysize);
             tty.Resize(wnd.xsize, wnd.ysize);
             wnd.Dirtify();
+            wnd_changed = true;
+            processed = true;
+          }
+
+          if (ctrl && !shift && !alt && ev.key.keysym.sym == SDLK_F12) {
+            overlay_visible = !overlay_visible;
+            if (overlay_visible)
+              UpdateStats(Clock::now());
+            wnd.Dirtify(); // present the whole frame again
+            wnd_changed = true;
             processed = true;
           }
 
@@ -347,30 +623,79 @@ int main() {
             if ((!alpha && !digit) || ctrl || alt) {
               if (shift && cval == '\t')
                 pending_input += "\33[Z";
-              else
-                pending_input += ToUTF8(std::u32string_view(&cval, 1));
+              else {
+                char Buf[4];
+                pending_input.append(
+                    Buf, ToUTF8(std::u32string_view(&cval, 1), Buf));
+              }
             }
 
             // Put the input in "pending_input", so that it gets automatically
             // canceled if a textinput event is generated.
           }
         } else {
-          if (!pending_input.empty()) {
-            tty.Send(std::move(pending_input));
-            pending_input.clear();
-          }
+          if (latency && !pending_input.empty())
+            latency->Input(EventTime(pending_time));
+          term.OutBuffer.Push(pending_input);
+          pending_input.clear();
         }
         break;
       }
       }
     }
-    if (!pending_input.empty())
-      tty.Send(std::move(pending_input));
+    if (latency && !pending_input.empty())
+      latency->Input(EventTime(pending_time));
+    term.OutBuffer.Push(pending_input);
+
+    // Replies and keystrokes are written right away, unless the PTY was
+    // full; then they wait for EPOLLOUT.
+    if (!term.OutBuffer.empty() && !term.OutBuffer.Blocked())
+      Flush();
+
+    auto now = Clock::now();
+    if (now >= next_stats) {
+      if (overlay_visible || stats_fd >= 0)
+        UpdateStats(now);
+      next_stats = std::max(next_stats + stats_interval, now);
+    }
+
+    // Render at most once per display refresh
+    if (now >= next_frame &&
+        (wnd_changed || wnd.Animating() || overlay_changed)) {
+      if (SDL_ReDraw(wnd, overlay) && latency)
+        latency->Presented(Clock::now());
+      wnd_changed = false;
+      next_frame = std::max(next_frame + frame_interval, now);
+    }
 
-    SDL_ReDraw(wnd);
+    // Presenting may have read input events from the X11 connection into
+    // Xlib's queue, where they would not wake epoll; pumping queues them
+    // for SDL, and signals event_fd.
+    if (input_fd >= 0)
+      SDL_PumpEvents();
   }
 
+  SDL_DelEventWatch(WatchEvent, &event_fd);
+  close(timer_fd);
+  close(event_fd);
+  close(epfd);
+
+  fprintf(stderr,
+          "PTY: %zu bytes in %zu reads, ring %zu KiB, at most %zu KiB used, "
+          "%zu stalls\n",
+          reader.BytesRead(), reader.Reads(), reader.Capacity() >> 10,
+          reader.MaxOccupancy() >> 10, reader.Stalls());
+  fprintf(stderr, "Output: %zu bytes in %zu writes, at most %zu queued\n",
+          term.OutBuffer.Written(), term.OutBuffer.Writes(),
+          term.OutBuffer.MaxSize());
+  fprintf(stderr, "Scrollback: %zu lines, %zu KiB in memory, %zu KiB in file\n",
+          wnd.scrollback.size(), wnd.scrollback.MemoryUsed() >> 10,
+          wnd.scrollback.FileUsed() >> 10);
+  if (latency)
+    latency->Report(stderr);
+
   tty.Kill(SIGHUP);
+  reader.Stop();
   tty.Close();
   return 0;
 }
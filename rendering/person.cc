@@ -1,7 +1,8 @@
 #include "256color.hh"
 #include "color.hh"
-#include <chrono>
-#include <cstring>
+#include "person.hh"
+#include <algorithm>
+#include <vector>
 
 static constexpr char persondata[] = "                      #####     "
                                      "      ######         #'''''###  "
@@ -20,37 +21,29 @@ static constexpr char persondata[] = "                      #####     "
                                      "     #'''''#      #'''#  #'''#  "
                                      "      #####        ###    ###   ";
 static constexpr unsigned xcoordinates[2] = {0, 16};
-static constexpr unsigned person_width = 16;
 static constexpr unsigned data_width = 32, data_lines = 16;
 
-static auto start_time = std::chrono::system_clock::now();
 static double walk_speed = 64.0; // pixels per second
 
-static int PersonBaseX(unsigned window_width) {
-  auto now_time = std::chrono::system_clock::now();
-
-  // X coordinate where The Person is
-  std::chrono::duration<double> time_elapsed = (now_time - start_time);
+// X coordinate where The Person is
+static int PersonBaseX(unsigned window_width, double seconds) {
   unsigned walkway_width =
       window_width + std::max(person_width, window_width / 5) + person_width;
-  return unsigned(time_elapsed.count() * walk_speed) % walkway_width -
-         person_width;
+  return unsigned(seconds * walk_speed) % walkway_width - person_width;
 }
 
-static int PersonFrame() {
-  auto now_time = std::chrono::system_clock::now();
-  std::chrono::duration<double> time_elapsed = (now_time - start_time);
-  return unsigned(time_elapsed.count() * 6) % 2;
+static unsigned PersonFrame(double seconds) {
+  return unsigned(seconds * 6) % 2;
 }
 
+// The gradient, resolved to a color for each x on even and odd pixels
+// (by x ^ y) for one window width.
 struct ColorSlideCache {
-  enum { MaxWidth = 3840 };
   const unsigned char *const colors;
   const unsigned short *const color_positions;
   const unsigned color_length;
   unsigned cached_width;
-  unsigned short cache_color[MaxWidth];
-  unsigned char cache_char[MaxWidth];
+  std::vector<unsigned> cache[2];
 
   ColorSlideCache(const unsigned char *c, const unsigned short *p, unsigned l)
       : colors(c), color_positions(p), color_length(l), cached_width(0) {}
@@ -60,12 +53,11 @@ struct ColorSlideCache {
       return;
 
     cached_width = w;
+    cache[0].resize(w);
+    cache[1].resize(w);
 
     unsigned char first = 0;
-    std::memset(cache_char, 0, sizeof(cache_char));
-    std::memset(cache_color, 0, sizeof(cache_color));
-
-    for (unsigned x = 0; x < w && x < MaxWidth; ++x) {
+    for (unsigned x = 0; x < w; ++x) {
       unsigned short cur_position = (((unsigned long)x) << 16u) / w;
       while (first < color_length && color_positions[first] <= cur_position)
         ++first;
@@ -95,18 +87,13 @@ struct ColorSlideCache {
         next_value = 0;
       }
 
-      cache_char[x] = ch;
-      cache_color[x] = prev_value | (next_value << 8u);
+      // Dither between the two colors halfway to the next one
+      cache[0][x] = xterm256table[prev_value];
+      cache[1][x] = xterm256table[ch ? next_value : prev_value];
     }
   }
 
-  inline void Get(unsigned x, unsigned char &ch, unsigned char &c1,
-                  unsigned char &c2) const {
-    unsigned short tmp = cache_color[x];
-    ch = cache_char[x];
-    c1 = tmp;
-    c2 = tmp >> 8u;
-  }
+  unsigned Get(unsigned x, unsigned y) const { return cache[(x ^ y) & 1][x]; }
 };
 
 static const unsigned char slide1_colors[21] = {6, 73, 109, 248, 7,  7,  7,
@@ -135,47 +122,40 @@ static ColorSlideCache slide1(slide1_colors, slide1_positions,
 static ColorSlideCache slide2(slide2_colors, slide2_positions,
                               sizeof(slide2_colors));
 
-void PersonTransform(unsigned &bgcolor, unsigned &fgcolor, unsigned width,
-                     unsigned x, unsigned y, unsigned action_type) {
+static PersonPosition frame_person;
+
+PersonPosition PersonBeginFrame(unsigned width, double seconds) {
+  slide1.SetWidth(width);
+  slide2.SetWidth(width);
+  frame_person = {PersonBaseX(width, seconds), PersonFrame(seconds)};
+  return frame_person;
+}
+
+void PersonTransform(unsigned &bgcolor, unsigned &fgcolor, unsigned x,
+                     unsigned y, unsigned action_type) {
   if (bgcolor != 0xACAAAC) {
     // Only transform lines with white (ansi 7) background
     return;
   }
 
-  auto GetSlide = [&](ColorSlideCache &slide) {
-    slide.SetWidth(width);
-    unsigned char ch, c1, c2;
-    slide.Get(x, ch, c1, c2);
-    unsigned result = c1;
-
-    if (ch) {
-      unsigned pos = (x ^ y) & 1;
-      result = pos ? c2 : c1;
-    }
-
-    return xterm256table[result];
-  };
-
   if (action_type <= 1)
-    bgcolor = GetSlide(slide1);
+    bgcolor = slide1.Get(x, y);
   if (action_type == 2)
-    bgcolor = GetSlide(slide2);
+    bgcolor = slide2.Get(x, y);
 
   if (y >= data_lines || action_type != 1) {
     // Don't change mario unless requested
     return;
   }
 
-  unsigned basex = PersonBaseX(width);
-  x -= basex;
+  x -= frame_person.x;
 
   // Person outside view?
   if (x >= person_width) {
     return;
   }
 
-  unsigned frame_number = PersonFrame();
-  unsigned frame_start = xcoordinates[frame_number];
+  unsigned frame_start = xcoordinates[frame_person.frame];
   char c = persondata[y * data_width + frame_start + x];
 
   switch (c) {
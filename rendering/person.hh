@@ -1,7 +1,17 @@
 #ifndef PERSON_H
 #define PERSON_H
 
-void PersonTransform(unsigned &bgcolor, unsigned &fgcolor, unsigned width,
-                     unsigned x, unsigned y, unsigned action_type);
+constexpr unsigned person_width = 16; // pixels
+
+struct PersonPosition {
+  int x;          // left edge on the top row, in pixels
+  unsigned frame; // of the walking animation
+};
+
+// Call once per frame, before that frame's PersonTransform calls, which
+// may then run in parallel. seconds is the animation time.
+PersonPosition PersonBeginFrame(unsigned width, double seconds);
+void PersonTransform(unsigned &bgcolor, unsigned &fgcolor, unsigned x,
+                     unsigned y, unsigned action_type);
 
 #endif /* PERSON_H */
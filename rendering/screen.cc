@@ -1,9 +1,22 @@
 #include "screen.hh"
 #include "color.hh"
 #include "person.hh"
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <cstring>
 #include <unordered_map>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 static const unsigned char p32font[32 * 256] = {
 #include "8x32.inc"
 };
@@ -98,10 +111,101 @@ static constexpr std::array<unsigned char, 16> taketables[] = {
 #undef i
 };
 
-void Window::Render(std::size_t fx, std::size_t fy, std::uint32_t *pixels) {
+static unsigned ThreadNumber() {
+#ifdef _OPENMP
+  return omp_get_thread_num();
+#else
+  return 0;
+#endif
+}
+
+// Writes width pixels, each Blend(fg, bg, take) with its own take.
+// ramp holds those colors for every take; with SIMD, runs of pixels are
+// blended directly in 16-bit fixed point instead.
+static void BlendRow(std::uint32_t *pix, const unsigned char *takes,
+                     std::size_t width, unsigned fg, unsigned bg,
+                     const std::uint32_t *ramp) {
+  std::size_t n = 0;
+  // Colors wider than 24 bits can go out of gamut and are left to ramp
+  std::size_t simd_width = (fg | bg) > 0xFFFFFF ? 0 : width;
+
+#if defined(__AVX2__)
+  {
+    // 4 pixels of 4 16-bit channels per register
+    const __m256i fg16 = _mm256_cvtepu8_epi16(_mm_set1_epi32(fg));
+    const __m256i bg16 = _mm256_cvtepu8_epi16(_mm_set1_epi32(bg));
+    const __m256i full = _mm256_set1_epi16(128);
+    // Spread take bytes 0-3 (or 4-7) over the channels of their pixel
+    const __m256i spread[2] = {
+        _mm256_setr_epi8(0, -1, 0, -1, 0, -1, 0, -1, 1, -1, 1, -1, 1, -1, 1,
+                         -1, 2, -1, 2, -1, 2, -1, 2, -1, 3, -1, 3, -1, 3, -1,
+                         3, -1),
+        _mm256_setr_epi8(4, -1, 4, -1, 4, -1, 4, -1, 5, -1, 5, -1, 5, -1, 5,
+                         -1, 6, -1, 6, -1, 6, -1, 6, -1, 7, -1, 7, -1, 7, -1,
+                         7, -1)};
+    for (; n + 8 <= simd_width; n += 8) {
+      long long eight;
+      std::memcpy(&eight, takes + n, 8);
+      __m256i t = _mm256_set1_epi64x(eight), result[2];
+      for (unsigned half = 0; half < 2; ++half) {
+        __m256i take = _mm256_shuffle_epi8(t, spread[half]);
+        __m256i untake = _mm256_subs_epu16(full, take);
+        result[half] = _mm256_srli_epi16(
+            _mm256_add_epi16(_mm256_mullo_epi16(fg16, untake),
+                             _mm256_mullo_epi16(bg16, take)),
+            7);
+      }
+      __m256i packed = _mm256_permute4x64_epi64(
+          _mm256_packus_epi16(result[0], result[1]), 0b11011000);
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(pix + n), packed);
+    }
+  }
+#endif
+#if defined(__SSE2__)
+  {
+    // 2 pixels of 4 16-bit channels per register
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i fg16 = _mm_unpacklo_epi8(_mm_set1_epi32(fg), zero);
+    const __m128i bg16 = _mm_unpacklo_epi8(_mm_set1_epi32(bg), zero);
+    const __m128i full = _mm_set1_epi16(128);
+    for (; n + 4 <= simd_width; n += 4) {
+      int four;
+      std::memcpy(&four, takes + n, 4);
+      __m128i t = _mm_unpacklo_epi8(_mm_cvtsi32_si128(four), zero);
+      t = _mm_unpacklo_epi16(t, t);
+      __m128i take[2] = {_mm_unpacklo_epi32(t, t), _mm_unpackhi_epi32(t, t)};
+      __m128i result[2];
+      for (unsigned half = 0; half < 2; ++half) {
+        __m128i untake = _mm_subs_epu16(full, take[half]);
+        result[half] = _mm_srli_epi16(
+            _mm_add_epi16(_mm_mullo_epi16(fg16, untake),
+                          _mm_mullo_epi16(bg16, take[half])),
+            7);
+      }
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(pix + n),
+                       _mm_packus_epi16(result[0], result[1]));
+    }
+  }
+#endif
+  for (; n < width; ++n)
+    pix[n] = ramp[takes[n]];
+}
+
+const std::vector<Rect> &Window::Render(std::size_t fx, std::size_t fy,
+                                        std::uint32_t *pixels) {
+  static const auto start = std::chrono::steady_clock::now();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return Render(fx, fy, pixels, elapsed.count());
+}
+
+const std::vector<Rect> &Window::Render(std::size_t fx, std::size_t fy,
+                                        std::uint32_t *pixels,
+                                        double seconds) {
+  damage.clear();
   auto i = fonts.find(fx * 256 + fy);
   if (i == fonts.end())
-    return;
+    return damage;
   const unsigned char *font = i->second;
 
   std::size_t character_size_in_bytes = (fx * fy + 7) / 8;
@@ -109,90 +213,217 @@ void Window::Render(std::size_t fx, std::size_t fy, std::uint32_t *pixels) {
 
   std::size_t screen_width = fx * xsize;
 
-  for (std::size_t y = 0; y < ysize; ++y) {
+  if (cursx != lastcursx || cursy != lastcursy || cursorvis != lastcursorvis) {
+    if (cursx < xsize && cursy < ysize)
+      Touch(cursx, cursy);
+    if (lastcursx < xsize && lastcursy < ysize)
+      Touch(lastcursx, lastcursy);
+  }
+
+  // Styles never change once interned, so only new ones need to be added
+  // unless the font size or the screenwide reverse mode changed. The
+  // rendered tiles are keyed by style id and are dropped along with them.
+  if (fx != info_fx || fy != info_fy || reverse != info_reverse) {
+    style_info.clear();
+    info_fx = fx;
+    info_fy = fy;
+    info_reverse = reverse;
+  }
+  if (style_info.empty())
+    for (auto &cache : tiles)
+      cache.Reset(fx * fy);
+
+  for (std::size_t n = style_info.size(); n < styles.size(); ++n) {
+    const Style &style = styles[n];
+    StyleInfo &si = style_info.emplace_back();
+    si.fg = style.fgcolor;
+    si.bg = style.bgcolor;
+    si.reversed = style.attr & Style::reverse;
+    if (si.reversed ^ reverse)
+      std::swap(si.fg, si.bg);
+    si.italic = style.attr & Style::italic;
+    si.mode = 8 * bool(style.attr & Style::bold) +
+              16 * bool(style.attr & Style::dim);
+    if (!si.reversed) // reversed cells get their colors per pixel
+      for (unsigned take = 0; take <= 128; ++take)
+        si.ramp[take] = Blend(si.fg, si.bg, take);
+    si.linerows = 0;
+    if (style.attr & (Style::underline | Style::underline2))
+      si.linerows |= 1ull << (fy - 1);
+    if ((style.attr & Style::underline2) && fy >= 3)
+      si.linerows |= 1ull << (fy - 3);
+    if (style.attr & Style::overstrike)
+      si.linerows |= 1ull << (fy / 2);
+  }
+
+  // PersonTransform only draws the person over white reversed cells
+  bool was_animating = animating;
+  animating = false;
+  for (std::size_t x = 0; x < (ysize ? xsize : 0) && !animating; ++x) {
+    const StyleInfo &si = style_info[Row(0)[x].style];
+    animating = si.reversed && si.bg == 0xACAAAC;
+  }
+
+  // The person walks along the top row; redraw where it was and is now,
+  // unless it is not shown in either frame
+  PersonPosition person = PersonBeginFrame(xsize * fx, seconds);
+  if (ysize > 0 && (animating || was_animating) &&
+      (animating != was_animating || person.x != last_person.x ||
+       person.frame != last_person.frame)) {
+    for (int px : {last_person.x, person.x}) {
+      int begin = std::max(px, 0);
+      int end = std::min<int>(px + person_width, xsize * fx);
+      if (begin < end)
+        Touch(begin / fx, 0, (end - 1) / fx - begin / fx + 1);
+    }
+  }
+  last_person = person;
+
+  // Renders one cell into out, whose rows are pitch pixels apart
+  auto draw = [&](const Cell &cell, const StyleInfo &si, bool cursor,
+                  std::size_t x, std::size_t y, std::uint32_t *out,
+                  std::size_t pitch) {
+    unsigned translated_ch = cell.ch;
+    if (translated_ch >= 256)
+      translated_ch = '?';
+
+    std::uint32_t cellfg = si.fg, cellbg = si.bg;
+    const std::uint32_t *ramp = si.ramp.data();
+    std::array<std::uint32_t, 129> cursor_ramp;
+    if (cursor) {
+      std::swap(cellfg, cellbg);
+      if (!si.reversed) {
+        for (unsigned take = 0; take <= 128; ++take)
+          cursor_ramp[take] = Blend(cellfg, cellbg, take);
+        ramp = cursor_ramp.data();
+      }
+    }
+
     for (std::size_t fr = 0; fr < fy; ++fr) {
-      std::uint32_t *pix = pixels + (y * fy + fr) * screen_width;
-      for (std::size_t x = 0; x < xsize; ++x) {
-        auto &cell = cells[y * xsize + x];
-        if (!cell.dirty && y > 0 /* always render line 0 because of person */ &&
-            (x != cursx || y != cursy) && (x != lastcursx || y != lastcursy)) {
-          pix += fx;
-          continue;
-        }
-        unsigned translated_ch = cell.ch;
-        if (translated_ch >= 256)
-          translated_ch = '?';
-
-        const unsigned char *fontptr = font +
-                                       translated_ch * character_size_in_bytes +
-                                       fr * font_row_size_in_bytes;
-
-        const unsigned mode =
-            cell.italic * (fr * 8 / fy) + 8 * cell.bold + 16 * cell.dim;
-
-        unsigned widefont = fontptr[0];
-        if (!cell.italic)
-          widefont <<= 1;
-
-        bool line = (cell.underline && (fr == (fy - 1))) ||
-                    (cell.underline2 && (fr == (fy - 1) || fr == (fy - 3))) ||
-                    (cell.overstrike && (fr == (fy / 2)));
-
-        for (std::size_t fc = 0; fc < fx; ++fc, ++pix) {
-          auto fg = cell.fgcolor;
-          auto bg = cell.bgcolor;
-
-          if (cell.reverse ^ (x == cursx && y == cursy && cursorvis) ^
-              reverse) {
-            std::swap(fg, bg);
-          }
-
-          unsigned mask = ((widefont << 2) >> (fx - fc)) & 0xF;
-          int take = taketables[mode][mask];
-          unsigned untake = std::max(0, 128 - take);
-
-          if (cell.reverse) {
-            PersonTransform(bg, fg, xsize * fx, x * fx + fc, y * fy + fr,
-                            y == 0             ? 1
-                            : y == (ysize - 1) ? 2
-                                               : 0);
-          }
-
-          unsigned color = Mix(bg, fg, untake, take, 128);
-
-          if (line && take == 0 && (!cell.reverse || color != 0x000000)) {
-            auto brightness = [](unsigned rgb) {
-              auto p = Unpack(rgb);
-              return p[0] * 299 + p[1] * 587 + p[2] * 114;
-            };
-
-            if (brightness(fg) > brightness(bg))
-              color = Mix(0x000000, color, 1, 1, 2);
-            else
-              color = Mix(0xFFFFFF, color, 1, 1, 2);
-          }
-
-          *pix = color;
+      std::uint32_t *pix = out + fr * pitch;
+
+      const unsigned char *fontptr = font +
+                                     translated_ch * character_size_in_bytes +
+                                     fr * font_row_size_in_bytes;
+
+      const unsigned mode = si.italic * (fr * 8 / fy) + si.mode;
+
+      unsigned widefont = fontptr[0];
+      if (!si.italic)
+        widefont <<= 1;
+
+      bool line = (si.linerows >> fr) & 1;
+
+      if (!si.reversed && !line) {
+        unsigned char takes[16];
+        for (std::size_t fc = 0; fc < fx; ++fc)
+          takes[fc] = taketables[mode][((widefont << 2) >> (fx - fc)) & 0xF];
+        BlendRow(pix, takes, fx, cellfg, cellbg, ramp);
+        continue;
+      }
+
+      for (std::size_t fc = 0; fc < fx; ++fc, ++pix) {
+        unsigned fg = cellfg;
+        unsigned bg = cellbg;
+
+        unsigned mask = ((widefont << 2) >> (fx - fc)) & 0xF;
+        int take = taketables[mode][mask];
+
+        if (si.reversed) {
+          PersonTransform(bg, fg, x * fx + fc, y * fy + fr,
+                          y == 0             ? 1
+                          : y == (ysize - 1) ? 2
+                                             : 0);
         }
 
-        if (fr == (fy - 1)) {
-          cell.dirty = false;
+        unsigned color = si.reversed ? Blend(fg, bg, take) : ramp[take];
+
+        if (line && take == 0 && (!si.reversed || color != 0x000000)) {
+          auto brightness = [](unsigned rgb) {
+            auto p = Unpack(rgb);
+            return p[0] * 299 + p[1] * 587 + p[2] * 114;
+          };
+
+          if (brightness(fg) > brightness(bg))
+            color = Mix(0x000000, color, 1, 1, 2);
+          else
+            color = Mix(0xFFFFFF, color, 1, 1, 2);
         }
+
+        *pix = color;
+      }
+    }
+  };
+
+  // Only rows with damage are handed out to the threads
+  bands.clear();
+  for (std::size_t y = 0; y < ysize; ++y) {
+    std::size_t begin = dirty[y].begin, end = std::min(dirty[y].end, xsize);
+    if (begin >= end)
+      continue;
+    dirty[y] = {};
+    bands.push_back({y, begin, end});
+    counters.cells_rendered += end - begin;
+
+    Rect rect{begin * fx, y * fy, (end - begin) * fx, fy};
+    if (!damage.empty() && damage.back().x == rect.x &&
+        damage.back().width == rect.width &&
+        damage.back().y + damage.back().height == rect.y)
+      damage.back().height += fy;
+    else
+      damage.push_back(rect);
+  }
+
+#pragma omp parallel for schedule(dynamic) if (bands.size() > 1)
+  for (std::size_t n = 0; n < bands.size(); ++n) {
+    auto [y, begin, end] = bands[n];
+    TileCache &cache = tiles[ThreadNumber()];
+
+    const Cell *row = Row(y);
+    for (std::size_t x = begin; x < end; ++x) {
+      const Cell &cell = row[x];
+      const StyleInfo &si = style_info[cell.style];
+      std::uint32_t *pix = pixels + y * fy * screen_width + x * fx;
+      bool cursor = x == cursx && y == cursy && cursorvis;
+
+      // The person animation depends on the position and time, and there
+      // is only one cursor, so these are not worth caching.
+      if (si.reversed || cursor) {
+        draw(cell, si, cursor, x, y, pix, screen_width);
+        continue;
       }
+
+      unsigned translated_ch = cell.ch < 256 ? cell.ch : U'?';
+      auto [tile, cached] =
+          cache.Get(std::uint64_t(cell.style) << 32 | translated_ch);
+      if (!cached)
+        draw(cell, si, false, x, y, tile, fx);
+      for (std::size_t fr = 0; fr < fy; ++fr)
+        std::memcpy(pix + fr * screen_width, tile + fr * fx,
+                    fx * sizeof(*tile));
     }
   }
 
+  for (auto &rect : damage)
+    counters.pixels_rendered += rect.width * rect.height;
+  counters.frames += !damage.empty();
   lastcursx = cursx;
   lastcursy = cursy;
+  lastcursorvis = cursorvis;
+  return damage;
 }
 
 void Window::Resize(std::size_t newsx, std::size_t newsy) {
-  std::vector<Cell> newcells(newsx * newsy, blank);
+  std::vector<Cell> newcells(newsx * newsy, Blank());
   for (std::size_t my = std::min(ysize, newsy), y = 0; y < my; ++y)
     for (std::size_t mx = std::min(xsize, newsx), x = 0; x < mx; ++x)
-      newcells[x + y * newsx] = cells[x + y * xsize];
+      newcells[x + y * newsx] = Row(y)[x];
 
   cells = std::move(newcells);
+  rows.resize(newsy);
+  for (std::size_t y = 0; y < newsy; ++y)
+    rows[y] = y;
+  dirty.resize(newsy);
   xsize = newsx;
   ysize = newsy;
 
@@ -202,6 +433,108 @@ void Window::Resize(std::size_t newsx, std::size_t newsy) {
 void Window::Dirtify() {
   lastcursx = lastcursy = ~std::size_t();
 
+  for (std::size_t y = 0; y < ysize; ++y)
+    dirty[y] = {0, xsize};
+}
+
+// Only the row order changes. Each row is compared with what was there
+// before, so that cells that stay the same, such as trailing blanks, are
+// not redrawn.
+void Window::ScrollUp(std::size_t y1, std::size_t y2, std::size_t amount,
+                      bool save) {
+  y2 = std::min(y2, ysize - 1);
+  if (y1 > y2 || amount == 0)
+    return;
+  amount = std::min(amount, y2 - y1 + 1);
+
+  if (save && y1 == 0)
+    for (std::size_t y = 0; y < amount; ++y)
+      scrollback.Push(Row(y), xsize, styles);
+
+  Cell fill = Blank();
+  for (std::size_t y = y1; y <= y2; ++y)
+    TouchChanged(y, y + amount <= y2 ? Row(y + amount) : nullptr, fill);
+
+  std::rotate(rows.begin() + y1, rows.begin() + y1 + amount,
+              rows.begin() + y2 + 1);
+  for (std::size_t y = y2 - amount + 1; y <= y2; ++y)
+    std::fill_n(Row(y), xsize, fill);
+}
+
+void Window::ScrollDown(std::size_t y1, std::size_t y2, std::size_t amount) {
+  y2 = std::min(y2, ysize - 1);
+  if (y1 > y2 || amount == 0)
+    return;
+  amount = std::min(amount, y2 - y1 + 1);
+
+  Cell fill = Blank();
+  for (std::size_t y = y1; y <= y2; ++y)
+    TouchChanged(y, y >= y1 + amount ? Row(y - amount) : nullptr, fill);
+
+  std::rotate(rows.begin() + y1, rows.begin() + y2 + 1 - amount,
+              rows.begin() + y2 + 1);
+  for (std::size_t y = y1; y < y1 + amount; ++y)
+    std::fill_n(Row(y), xsize, fill);
+}
+
+// Marks the columns of row y that differ from newrow, or from fill if
+// newrow is null.
+void Window::TouchChanged(std::size_t y, const Cell *newrow,
+                          const Cell &fill) {
+  const Cell *row = Row(y);
+  auto get = [&](std::size_t x) { return newrow ? newrow[x] : fill; };
+  std::size_t begin = 0, end = xsize;
+  while (begin < end && row[begin] == get(begin))
+    ++begin;
+  while (end > begin && row[end - 1] == get(end - 1))
+    --end;
+  if (begin < end)
+    Touch(begin, y, end - begin);
+}
+
+std::size_t Window::MaxThreads() {
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+std::uint32_t Window::Intern(const Style &style) {
+  auto i = style_ids.find(style);
+  if (i != style_ids.end())
+    return i->second;
+
+  if (styles.size() >= style_limit) {
+    CompactStyles();
+    style_limit = std::max(style_limit, 2 * styles.size());
+  }
+
+  std::uint32_t id = styles.size();
+  styles.push_back(style);
+  style_ids.emplace(style, id);
+  return id;
+}
+
+// Drops the styles that neither a cell nor the pen refers to any more,
+// e.g. after a program has cycled through many truecolor values.
+void Window::CompactStyles() {
+  std::vector<std::uint32_t> remap(styles.size(), ~0u);
+  std::vector<Style> kept;
+  auto keep = [&](std::uint32_t &id) {
+    if (remap[id] == ~0u) {
+      remap[id] = kept.size();
+      kept.push_back(styles[id]);
+    }
+    id = remap[id];
+  };
   for (auto &c : cells)
-    c.dirty = true;
+    keep(c.style);
+  keep(pen_id);
+
+  styles = std::move(kept);
+  style_info.clear();
+  style_ids.clear();
+  for (std::uint32_t n = 0; n < styles.size(); ++n)
+    style_ids.emplace(styles[n], n);
 }
@@ -1,64 +1,150 @@
 #ifndef SCREEN_H
 #define SCREEN_H
 
+#include "person.hh"
+#include "scrollback.hh"
+#include "tilecache.hh"
+#include <algorithm>
+#include <array>
 #include <bits/c++config.h>
 #include <cstdint>
 #include <cstdio>
-#include <tuple>
+#include <cstring>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
+// Colors and SGR attributes. Each distinct style is stored once, in
+// Window::styles, and cells refer to it by index.
+struct Style {
+  enum : std::uint32_t {
+    bold = 1u << 0,
+    dim = 1u << 1,
+    italic = 1u << 2,
+    underline = 1u << 3,
+    underline2 = 1u << 4,
+    overstrike = 1u << 5,
+    reverse = 1u << 6,
+    blink = 1u << 7,
+    framed = 1u << 8,
+    encircled = 1u << 9,
+    overlined = 1u << 10,
+    fraktur = 1u << 11,
+    conceal = 1u << 12,
+  };
+
+  std::uint32_t fgcolor = 0xAAAAAA;
+  std::uint32_t bgcolor = 0x000000;
+  std::uint32_t attr = 0;
+
+  bool operator==(const Style &b) const {
+    return std::memcmp(this, &b, sizeof(Style)) == 0;
+  }
+
+  bool operator!=(const Style &b) const { return !operator==(b); }
+};
+static_assert(std::has_unique_object_representations_v<Style>);
+
+struct StyleHash {
+  std::size_t operator()(const Style &s) const {
+    std::uint64_t h = (std::uint64_t(s.fgcolor) << 32 | s.bgcolor) ^ s.attr;
+    return h * 0x9E3779B97F4A7C15ull >> 16;
+  }
+};
+
+// Since styles are interned, two cells look the same exactly when they
+// compare equal.
 struct Cell {
-  std::uint_least32_t fgcolor = 0xAAAAAA;
-  std::uint_least32_t bgcolor = 0x000000;
   char32_t ch = U' ';
-  bool bold = false;
-  bool dim = false;
-  bool italic = false;
-  bool underline = false;
-  bool underline2 = false;
-  bool overstrike = false;
-  bool reverse = false;
-  bool blink = false;
-  bool framed = false;
-  bool encircled = false;
-  bool overlined = false;
-  bool fraktur = false;
-  bool conceal = false;
-  bool dirty = true;
+  std::uint32_t style = 0; // index into Window::styles
 
   bool operator==(const Cell &b) const {
-    return std::tuple(fgcolor, bgcolor, ch, bold, dim, italic, underline,
-                      underline2, overstrike, reverse, blink, framed, encircled,
-                      fraktur, conceal, overlined) ==
-           std::tuple(b.fgcolor, b.bgcolor, b.ch, b.bold, b.dim, b.italic,
-                      b.underline, b.underline2, b.overstrike, b.reverse,
-                      b.blink, b.framed, b.encircled, b.fraktur, b.conceal,
-                      b.overlined);
+    return std::memcmp(this, &b, sizeof(Cell)) == 0;
   }
 
   bool operator!=(const Cell &b) const { return !operator==(b); }
 };
+static_assert(sizeof(Cell) == 8 &&
+              std::has_unique_object_representations_v<Cell>);
+
+// A rectangle of pixels, as returned by Window::Render.
+struct Rect {
+  std::size_t x, y, width, height;
+};
 
 struct Window {
   std::vector<Cell> cells;
+  // Screen row y is stored at cells[rows[y] * xsize], so that scrolling
+  // only has to reorder rows.
+  std::vector<std::size_t> rows;
+  // For each row, the columns [begin, end) that need to be redrawn.
+  struct DirtySpan {
+    std::size_t begin = 0, end = 0;
+  };
+  std::vector<DirtySpan> dirty;
+  Scrollback scrollback; // rows that scrolled off the top
   std::size_t xsize, ysize;
   std::size_t cursx = 0, cursy = 0;
   bool reverse = false;
   bool cursorvis = true;
-  Cell blank{};
+  Style blank{}; // the current pen
+  std::vector<Style> styles{Style{}};
+
+  // Running totals, for statistics
+  struct Counters {
+    std::uint64_t cells_put = 0, cells_changed = 0; // by PutCh and PutText
+    std::uint64_t cells_rendered = 0, pixels_rendered = 0, frames = 0;
+  } counters;
 
 private:
   std::size_t lastcursx, lastcursy;
+  bool lastcursorvis = true;
+  PersonPosition last_person{};
+  bool animating = false;
+  std::unordered_map<Style, std::uint32_t, StyleHash> style_ids{{Style{}, 0}};
+  std::size_t style_limit = 4096;
+  Style pen_style{};
+  std::uint32_t pen_id = 0;
+
+  // Everything about a style that Render needs, other than the position
+  struct StyleInfo {
+    std::uint32_t fg, bg;
+    std::uint64_t linerows; // font rows that get a line drawn over them
+    unsigned mode;          // taketables index, before the italic slant
+    bool italic, reversed;
+    std::array<std::uint32_t, 129> ramp; // Blend(fg, bg, take) by take
+  };
+  std::vector<StyleInfo> style_info;
+  std::size_t info_fx = 0, info_fy = 0;
+  bool info_reverse = false;
+  std::vector<Rect> damage;
+  std::vector<TileCache> tiles; // one per thread
+  struct Band {
+    std::size_t y, begin, end;
+  };
+  std::vector<Band> bands;
 
 public:
   Window(std::size_t xs, std::size_t ys)
-      : cells(xs * ys), xsize(xs), ysize(ys) {
+      : cells(xs * ys), rows(ys), dirty(ys), xsize(xs), ysize(ys),
+        tiles(MaxThreads()) {
+    for (std::size_t y = 0; y < ys; ++y)
+      rows[y] = y;
     Dirtify();
   }
 
+  // A cell with the current pen.
+  Cell Blank(char32_t ch = U' ') {
+    if (blank != pen_style) {
+      pen_id = Intern(blank);
+      pen_style = blank;
+    }
+    return Cell{ch, pen_id};
+  }
+
   void fillbox(std::size_t x, std::size_t y, std::size_t width,
                std::size_t height) {
-    fillbox(x, y, width, height, blank);
+    fillbox(x, y, width, height, Blank());
   }
 
   void fillbox(std::size_t x, std::size_t y, std::size_t width,
@@ -73,10 +159,10 @@ public:
     auto hcopy_oneline = [&](std::size_t ty, std::size_t sy) {
       if (tgtx < srcx)
         for (std::size_t w = 0; w < width; ++w)
-          PutCh(tgtx + w, ty, cells[sy * xsize + (srcx + w)]);
+          PutCh(tgtx + w, ty, Row(sy)[srcx + w]);
       else
         for (std::size_t w = width; w-- > 0;)
-          PutCh(tgtx + w, ty, cells[sy * xsize + (srcx + w)]);
+          PutCh(tgtx + w, ty, Row(sy)[srcx + w]);
     };
 
     if (tgty < srcy)
@@ -87,28 +173,78 @@ public:
         hcopy_oneline(tgty + h, srcy + h);
   }
 
+  Cell *Row(std::size_t y) { return &cells[rows[y] * xsize]; }
+
+  // Scroll rows y1..y2 by amount rows, filling the vacated rows with
+  // blanks. If save is set, rows that scroll off the top of the screen
+  // are kept in scrollback; deleted lines are not.
+  void ScrollUp(std::size_t y1, std::size_t y2, std::size_t amount,
+                bool save = false);
+  void ScrollDown(std::size_t y1, std::size_t y2, std::size_t amount);
+
   void PutCh(std::size_t x, std::size_t y, const Cell &c) {
-    auto &tgt = cells[y * xsize + x];
+    Cell &tgt = Row(y)[x];
+    ++counters.cells_put;
     if (tgt != c) {
       tgt = c;
-      tgt.dirty = true;
+      Touch(x, y);
+      ++counters.cells_changed;
     }
   }
 
   void PutCh(std::size_t x, std::size_t y, char32_t c, int cset = 0) {
-    Cell ch = blank;
-    ch.ch = c;
-    /*if (c != U' ') {
-      fprintf(stderr, "Ch at (%zu, %zu): <%c>\n", x, y, int(c));
+    PutCh(x, y, Blank(c));
+  }
+
+  // Puts a run of characters on one row with the current attributes.
+  // CharT may be char for plain ASCII text.
+  template <typename CharT>
+  void PutText(std::size_t x, std::size_t y, const CharT *text,
+               std::size_t length) {
+    Cell ch = Blank();
+    Cell *tgt = Row(y) + x;
+    std::size_t first = length, last = 0, changed = 0;
+    for (std::size_t n = 0; n < length; ++n) {
+      ch.ch = std::make_unsigned_t<CharT>(text[n]);
+      if (tgt[n] != ch) {
+        tgt[n] = ch;
+        ++changed;
+        first = std::min(first, n);
+        last = n + 1;
+      }
     }
-    */
+    if (first < last)
+      Touch(x + first, y, last - first);
+    counters.cells_put += length;
+    counters.cells_changed += changed;
+  }
 
-    PutCh(x, y, ch);
+  void Touch(std::size_t x, std::size_t y, std::size_t width = 1) {
+    auto &span = dirty[y];
+    if (span.begin >= span.end)
+      span = {x, x + width};
+    else
+      span = {std::min(span.begin, x), std::max(span.end, x + width)};
   }
 
-  void Render(std::size_t fx, std::size_t fy, std::uint32_t *pixels);
+  // Returns the pixel rectangles that were redrawn. The vector is reused
+  // by the next call. seconds is the animation time; by default, the time
+  // since the first call.
+  const std::vector<Rect> &Render(std::size_t fx, std::size_t fy,
+                                  std::uint32_t *pixels);
+  const std::vector<Rect> &Render(std::size_t fx, std::size_t fy,
+                                  std::uint32_t *pixels, double seconds);
+  // Whether the last Render drew the person, which moves even when nothing
+  // else changes.
+  bool Animating() const { return animating; }
   void Resize(std::size_t newsx, std::size_t newsy);
   void Dirtify();
+
+private:
+  static std::size_t MaxThreads();
+  std::uint32_t Intern(const Style &style);
+  void CompactStyles();
+  void TouchChanged(std::size_t y, const Cell *newrow, const Cell &fill);
 };
 
 #endif /* SCREEN_H */
@@ -0,0 +1,171 @@
+#include "scrollback.hh"
+#include "ctype.hh"
+#include "screen.hh"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static constexpr std::size_t block_size = 64 << 10;
+
+static void PutVarint(std::vector<char> &out, std::size_t value) {
+  for (; value >= 0x80; value >>= 7)
+    out.push_back(char(value | 0x80));
+  out.push_back(char(value));
+}
+
+static std::size_t GetVarint(const char *&p) {
+  std::size_t value = 0;
+  for (unsigned shift = 0;; shift += 7) {
+    unsigned char byte = *p++;
+    value |= std::size_t(byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+      return value;
+  }
+}
+
+// Whether a blank with this style looks the same as the end of a line.
+static bool Invisible(const Style &style) {
+  return style.bgcolor == Style{}.bgcolor &&
+         !(style.attr & (Style::reverse | Style::underline |
+                         Style::underline2 | Style::overstrike));
+}
+
+Scrollback::~Scrollback() {
+  for (auto &b : blocks)
+    if (b.mapped)
+      munmap(const_cast<char *>(b.mapped), b.mapped_size);
+  if (spill_fd >= 0)
+    close(spill_fd);
+}
+
+void Scrollback::SetMemoryBudget(std::size_t bytes) {
+  memory_budget = bytes;
+  while (memory_used > memory_budget && blocks.size() > spilled_blocks + 1)
+    Evict();
+}
+
+bool Scrollback::EnableSpill(const char *directory, std::size_t budget) {
+  if (spill_fd < 0) {
+    std::string path = std::string(directory) + "/scrollback-XXXXXX";
+    spill_fd = mkstemp(&path[0]);
+    if (spill_fd < 0)
+      return false;
+    unlink(path.c_str());
+  }
+  file_budget = budget;
+  return true;
+}
+
+void Scrollback::Push(const Cell *row, std::size_t width,
+                      const std::vector<Style> &styles) {
+  while (width > 0 && row[width - 1].ch == U' ' &&
+         Invisible(styles[row[width - 1].style]))
+    --width;
+
+  if (blocks.size() == spilled_blocks ||
+      blocks.back().data.size() >= block_size) {
+    Block &b = blocks.emplace_back();
+    b.first = total_lines;
+    b.data.reserve(block_size + 4096);
+  }
+  Block &b = blocks.back();
+  std::vector<char> &out = b.data;
+  std::size_t start = out.size();
+  b.offsets.push_back(start);
+
+  PutVarint(out, width);
+  for (std::size_t x = 0; x < width;) {
+    std::size_t end = x + 1;
+    while (end < width && row[end].style == row[x].style)
+      ++end;
+    PutVarint(out, end - x);
+    const char *style = reinterpret_cast<const char *>(&styles[row[x].style]);
+    out.insert(out.end(), style, style + sizeof(Style));
+    x = end;
+  }
+
+  text_buffer.resize(width);
+  for (std::size_t x = 0; x < width; ++x)
+    text_buffer[x] = row[x].ch;
+  std::size_t pos = out.size();
+  out.resize(pos + 4 * width);
+  out.resize(pos + ToUTF8(text_buffer, &out[pos]));
+
+  ++total_lines;
+  memory_used += out.size() - start + sizeof(std::uint32_t);
+  while (memory_used > memory_budget && blocks.size() > spilled_blocks + 1)
+    Evict();
+}
+
+void Scrollback::Get(std::size_t n, std::u32string &text,
+                     std::vector<Style> &styles) const {
+  std::size_t line = dropped_lines + n;
+  auto i = std::upper_bound(
+      blocks.begin(), blocks.end(), line,
+      [](std::size_t l, const Block &b) { return l < b.first; });
+  const Block &b = *--i;
+  std::size_t k = line - b.first;
+  const char *p = b.Data() + b.offsets[k];
+  const char *end =
+      b.Data() + (k + 1 < b.offsets.size() ? b.offsets[k + 1] : b.Size());
+
+  std::size_t width = GetVarint(p);
+  for (std::size_t x = 0; x < width;) {
+    std::size_t length = GetVarint(p);
+    Style style;
+    std::memcpy(&style, p, sizeof(Style));
+    p += sizeof(Style);
+    styles.insert(styles.end(), length, style);
+    x += length;
+  }
+  text += FromUTF8(std::string_view(p, end - p));
+}
+
+// Moves the oldest block in memory to the spill file, or drops it.
+void Scrollback::Evict() {
+  Block &b = blocks[spilled_blocks];
+  std::size_t size = b.data.size();
+
+  if (spill_fd >= 0 && file_budget >= size) {
+    std::size_t page = sysconf(_SC_PAGESIZE);
+    std::size_t mapped_size = (size + page - 1) / page * page;
+    void *map = MAP_FAILED;
+    if (pwrite(spill_fd, b.data.data(), size, file_end) == ssize_t(size))
+      map = mmap(nullptr, size, PROT_READ, MAP_SHARED, spill_fd, file_end);
+    if (map != MAP_FAILED) {
+      memory_used -= size;
+      b.mapped = static_cast<const char *>(map);
+      b.mapped_size = size;
+      b.file_offset = file_end;
+      std::vector<char>().swap(b.data);
+      file_end += mapped_size;
+      file_used += mapped_size;
+      ++spilled_blocks;
+      while (file_used > file_budget)
+        DropOldest();
+      return;
+    }
+  }
+  DropOldest();
+}
+
+void Scrollback::DropOldest() {
+  Block &b = blocks.front();
+  if (b.mapped) {
+    std::size_t page = sysconf(_SC_PAGESIZE);
+    std::size_t mapped_size = (b.mapped_size + page - 1) / page * page;
+    munmap(const_cast<char *>(b.mapped), b.mapped_size);
+    // Give the disk space back; the file itself only ever grows.
+    fallocate(spill_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+              b.file_offset, mapped_size);
+    file_used -= mapped_size;
+    --spilled_blocks;
+  }
+  memory_used -= b.data.size() + b.offsets.size() * sizeof(std::uint32_t);
+  dropped_lines += b.offsets.size();
+  blocks.pop_front();
+}
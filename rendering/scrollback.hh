@@ -0,0 +1,71 @@
+#ifndef SCROLLBACK_H
+#define SCROLLBACK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+struct Cell;
+struct Style;
+
+// Lines that scrolled off the top of the screen, oldest first.
+//
+// Each line is stored as its width, the runs of cells sharing a style,
+// and its text as UTF-8, with trailing blanks trimmed. Lines are packed
+// into blocks. When the blocks in memory exceed the memory budget, the
+// oldest one is dropped, or written to the spill file and mapped back
+// read-only if spilling is enabled.
+class Scrollback {
+public:
+  explicit Scrollback(std::size_t memory_budget = 32u << 20)
+      : memory_budget(memory_budget) {}
+  Scrollback(const Scrollback &) = delete;
+  Scrollback &operator=(const Scrollback &) = delete;
+  ~Scrollback();
+
+  void SetMemoryBudget(std::size_t bytes);
+
+  // Keeps up to file_budget bytes of older history in an unlinked file
+  // in directory. Returns false if the file cannot be created.
+  bool EnableSpill(const char *directory, std::size_t file_budget);
+
+  void Push(const Cell *row, std::size_t width,
+            const std::vector<Style> &styles);
+
+  std::size_t size() const { return total_lines - dropped_lines; }
+
+  // Appends line n (0 is the oldest) to text, and the style of each of
+  // its characters to styles.
+  void Get(std::size_t n, std::u32string &text,
+           std::vector<Style> &styles) const;
+
+  std::size_t MemoryUsed() const { return memory_used; }
+  std::size_t FileUsed() const { return file_used; }
+
+private:
+  struct Block {
+    std::size_t first; // number of the first line in this block
+    std::vector<std::uint32_t> offsets; // where each line starts
+    std::vector<char> data;
+    const char *mapped = nullptr; // data, once spilled
+    std::size_t mapped_size = 0, file_offset = 0;
+
+    const char *Data() const { return mapped ? mapped : data.data(); }
+    std::size_t Size() const { return mapped ? mapped_size : data.size(); }
+  };
+
+  void Evict();
+  void DropOldest();
+
+  std::deque<Block> blocks;
+  std::size_t spilled_blocks = 0; // the first ones in blocks
+  std::size_t total_lines = 0, dropped_lines = 0;
+  std::size_t memory_budget, memory_used = 0;
+  std::size_t file_budget = 0, file_used = 0, file_end = 0;
+  int spill_fd = -1;
+  std::u32string text_buffer;
+};
+
+#endif /* SCROLLBACK_H */
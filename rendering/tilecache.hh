@@ -0,0 +1,81 @@
+#ifndef TILECACHE_H
+#define TILECACHE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Rendered cells, tile_pixels pixels each, keyed by whatever determines
+// their look. The least recently used tile is replaced when full.
+class TileCache {
+public:
+  void Reset(std::size_t pixels_per_tile) {
+    tile_pixels = pixels_per_tile;
+    capacity = std::max<std::size_t>(256, memory_budget / (tile_pixels * 4));
+    pixels.clear();
+    entries.clear();
+    index.clear();
+    head = tail = none;
+  }
+
+  // Returns the tile for key, and whether it already holds the pixels.
+  // The pointer stays valid until the next call.
+  std::pair<std::uint32_t *, bool> Get(std::uint64_t key) {
+    auto i = index.find(key);
+    if (i != index.end()) {
+      if (i->second != head) {
+        Unlink(i->second);
+        PushFront(i->second);
+      }
+      return {&pixels[i->second * tile_pixels], true};
+    }
+
+    std::uint32_t slot;
+    if (entries.size() < capacity) {
+      slot = entries.size();
+      entries.emplace_back();
+      pixels.resize(entries.size() * tile_pixels);
+    } else {
+      slot = tail;
+      Unlink(slot);
+      index.erase(entries[slot].key);
+    }
+    entries[slot].key = key;
+    index.emplace(key, slot);
+    PushFront(slot);
+    return {&pixels[slot * tile_pixels], false};
+  }
+
+private:
+  static constexpr std::uint32_t none = ~0u;
+  static constexpr std::size_t memory_budget = 4u << 20;
+
+  struct Entry {
+    std::uint64_t key;
+    std::uint32_t prev, next; // towards head, towards tail
+  };
+
+  void Unlink(std::uint32_t n) {
+    Entry &e = entries[n];
+    (e.prev != none ? entries[e.prev].next : head) = e.next;
+    (e.next != none ? entries[e.next].prev : tail) = e.prev;
+  }
+
+  void PushFront(std::uint32_t n) {
+    entries[n].prev = none;
+    entries[n].next = head;
+    (head != none ? entries[head].prev : tail) = n;
+    head = n;
+  }
+
+  std::size_t tile_pixels = 0, capacity = 0;
+  std::vector<std::uint32_t> pixels;
+  std::vector<Entry> entries; // most recently used first, from head
+  std::unordered_map<std::uint64_t, std::uint32_t> index;
+  std::uint32_t head = none, tail = none;
+};
+
+#endif /* TILECACHE_H */
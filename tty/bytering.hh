@@ -0,0 +1,64 @@
+#ifndef BYTERING_H
+#define BYTERING_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// A lock-free ring of bytes for exactly one producer thread and one
+// consumer thread. The capacity is rounded up to a power of two.
+class ByteRing {
+public:
+  explicit ByteRing(std::size_t capacity) {
+    std::size_t size = 4096;
+    while (size < capacity)
+      size *= 2;
+    buffer.resize(size);
+  }
+
+  std::size_t capacity() const { return buffer.size(); }
+  std::size_t size() const {
+    return head.load(std::memory_order_acquire) -
+           tail.load(std::memory_order_acquire);
+  }
+
+  // Producer: the longest contiguous span that can be written. Nothing
+  // in it is visible to the consumer until Commit.
+  std::pair<char *, std::size_t> WriteSpan() {
+    std::size_t h = head.load(std::memory_order_relaxed);
+    std::size_t room = capacity() - (h - tail.load(std::memory_order_acquire));
+    std::size_t at = h & (capacity() - 1);
+    return {&buffer[at], std::min(room, capacity() - at)};
+  }
+
+  // Producer: hands the first n bytes of the span to the consumer.
+  void Commit(std::size_t n) {
+    head.store(head.load(std::memory_order_relaxed) + n,
+               std::memory_order_release);
+  }
+
+  // Consumer: the longest contiguous span of unread bytes.
+  std::string_view Peek() const {
+    std::size_t t = tail.load(std::memory_order_relaxed);
+    std::size_t n = head.load(std::memory_order_acquire) - t;
+    std::size_t at = t & (capacity() - 1);
+    return {&buffer[at], std::min(n, capacity() - at)};
+  }
+
+  // Consumer: releases the first n unread bytes to the producer.
+  void Consume(std::size_t n) {
+    tail.store(tail.load(std::memory_order_relaxed) + n);
+  }
+
+private:
+  std::vector<char> buffer;
+  // Total bytes ever written and read. Kept apart so that the two threads
+  // do not share a cache line.
+  alignas(64) std::atomic<std::size_t> head{0};
+  alignas(64) std::atomic<std::size_t> tail{0};
+};
+
+#endif /* BYTERING_H */
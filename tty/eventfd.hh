@@ -0,0 +1,22 @@
+#ifndef EVENTFD_H
+#define EVENTFD_H
+
+#include <cerrno>
+#include <cstdint>
+#include <unistd.h>
+
+// Adds one to the counter of an eventfd, waking whoever polls it
+inline void SignalEventFD(int fd) {
+  std::uint64_t one = 1;
+  while (write(fd, &one, sizeof(one)) < 0 && errno == EINTR) {
+  }
+}
+
+// Reads and resets the counter of a non-blocking eventfd or timerfd
+inline void DrainEventFD(int fd) {
+  std::uint64_t count;
+  while (read(fd, &count, sizeof(count)) < 0 && errno == EINTR) {
+  }
+}
+
+#endif /* EVENTFD_H */
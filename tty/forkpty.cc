@@ -1,4 +1,5 @@
 #include "forkpty.hh"
+#include <algorithm>
 #include <cstdlib>
 #include <fcntl.h>
 #include <pty.h>
@@ -6,7 +7,7 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
-void ForkPTY::Open(std::size_t w, std::size_t h) {
+void ForkPTY::Open(std::size_t w, std::size_t h, const char *command) {
   struct winsize ws = {};
   ws.ws_col = w;
   ws.ws_row = h;
@@ -14,24 +15,19 @@ void ForkPTY::Open(std::size_t w, std::size_t h) {
   if (!pid) {
     static char termstr[] = "TERM=linux";
     putenv(termstr);
-    execl(getenv("SHELL"), getenv("SHELL"), "-i", "-l", nullptr);
+    if (command)
+      execl("/bin/sh", "sh", "-c", command, nullptr);
+    else
+      execl(getenv("SHELL"), getenv("SHELL"), "-i", "-l", nullptr);
+    _exit(127);
   }
   fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
 }
 
-int ForkPTY::Send(std::string_view buffer) {
-  return write(fd, buffer.data(), buffer.size());
-}
-
-std::pair<std::string, int> ForkPTY::Recv() {
-  char buffer[4096];
-  std::pair<std::string, int> result;
-
-  result.second = read(fd, buffer, sizeof(buffer));
-  if (result.second > 0)
-    result.first.assign(buffer, buffer + result.second);
-
-  return result;
+std::pair<std::string_view, int> ForkPTY::Recv(char *buffer,
+                                                std::size_t size) {
+  int result = read(fd, buffer, size);
+  return {std::string_view(buffer, std::max(result, 0)), result};
 }
 
 void ForkPTY::Kill(int signal) { kill(pid, signal); }
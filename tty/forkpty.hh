@@ -6,14 +6,18 @@
 
 class ForkPTY {
 public:
-  ForkPTY(std::size_t w, std::size_t h) { Open(w, h); }
+  // Runs command with sh -c, or else $SHELL as a login shell
+  ForkPTY(std::size_t w, std::size_t h, const char *command = nullptr) {
+    Open(w, h, command);
+  }
 
-  void Open(std::size_t w, std::size_t h);
+  void Open(std::size_t w, std::size_t h, const char *command = nullptr);
 
   int getfd() const { return fd; }
 
-  int Send(std::string_view buffer);
-  std::pair<std::string, int> Recv();
+  // Reads up to size bytes into buffer. Returns what was read, and the
+  // result of read(2).
+  std::pair<std::string_view, int> Recv(char *buffer, std::size_t size);
   void Kill(int signal);
   void Resize(unsigned xsize, unsigned ysize);
   void Close();
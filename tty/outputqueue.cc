@@ -0,0 +1,69 @@
+#include "outputqueue.hh"
+#include "ctype.hh"
+#include <algorithm>
+#include <cerrno>
+#include <sys/uio.h>
+
+// Small writes are appended to the last chunk, up to this size
+static constexpr std::size_t chunk_size = 4096;
+
+std::string &OutputQueue::Tail(std::size_t room) {
+  if (chunks.empty() || chunks.back().size() + room > chunk_size)
+    chunks.emplace_back().reserve(std::max(room, chunk_size));
+  return chunks.back();
+}
+
+void OutputQueue::Push(std::string_view bytes) {
+  if (bytes.empty())
+    return;
+  Tail(bytes.size()) += bytes;
+  queued += bytes.size();
+  max_queued = std::max(max_queued, queued);
+}
+
+void OutputQueue::Push(std::u32string_view text) {
+  if (text.empty())
+    return;
+  // Encoded in place, at most four bytes per character
+  std::string &tail = Tail(text.size() * 4);
+  std::size_t pos = tail.size();
+  tail.resize(pos + text.size() * 4);
+  tail.resize(pos + ToUTF8(text, &tail[pos]));
+  queued += tail.size() - pos;
+  max_queued = std::max(max_queued, queued);
+}
+
+bool OutputQueue::Flush(int fd) {
+  blocked = false;
+  while (!chunks.empty()) {
+    struct iovec iov[16];
+    int count = 0;
+    for (auto &c : chunks) {
+      std::size_t skip = count ? 0 : offset;
+      iov[count++] = {&c[skip], c.size() - skip};
+      if (count == int(std::size(iov)))
+        break;
+    }
+
+    ssize_t result = writev(fd, iov, count);
+    if (result < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        blocked = true;
+        return true;
+      }
+      chunks.clear();
+      offset = queued = 0;
+      return false;
+    }
+
+    ++writes;
+    written += result;
+    queued -= result;
+    for (offset += result; !chunks.empty() && offset >= chunks.front().size();
+         chunks.pop_front())
+      offset -= chunks.front().size();
+  }
+  return true;
+}
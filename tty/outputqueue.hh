@@ -0,0 +1,39 @@
+#ifndef OUTPUTQUEUE_H
+#define OUTPUTQUEUE_H
+
+#include <cstddef>
+#include <deque>
+#include <string>
+
+// UTF-8 bytes waiting to be written to the PTY: replies of the terminal
+// and keystrokes, in the order they were queued.
+class OutputQueue {
+public:
+  void Push(std::string_view bytes);
+  void Push(std::u32string_view text);
+
+  bool empty() const { return queued == 0; }
+  std::size_t size() const { return queued; } // bytes
+
+  // Writes as much as fd takes without blocking. Blocked() is then true
+  // if fd did not take everything, and Flush should be retried on POLLOUT.
+  // On an error, the queue is discarded and false is returned.
+  bool Flush(int fd);
+  bool Blocked() const { return blocked; }
+
+  // For tuning
+  std::size_t MaxSize() const { return max_queued; }
+  std::size_t Written() const { return written; }
+  std::size_t Writes() const { return writes; }
+
+private:
+  // The last chunk, or a new one if it lacks room for this many bytes
+  std::string &Tail(std::size_t room);
+
+  std::deque<std::string> chunks;
+  std::size_t offset = 0; // already written of chunks.front()
+  std::size_t queued = 0, max_queued = 0, written = 0, writes = 0;
+  bool blocked = false;
+};
+
+#endif /* OUTPUTQUEUE_H */
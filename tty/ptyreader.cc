@@ -0,0 +1,88 @@
+#include "ptyreader.hh"
+#include "eventfd.hh"
+#include "forkpty.hh"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+PTYReader::PTYReader(ForkPTY &tty, std::size_t capacity)
+    : tty(tty), ring(capacity),
+      data_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+      wake_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+      thread(&PTYReader::Run, this) {}
+
+void PTYReader::Stop() {
+  if (!thread.joinable())
+    return;
+  stop = true;
+  SignalEventFD(wake_fd);
+  thread.join();
+  close(data_fd);
+  close(wake_fd);
+}
+
+void PTYReader::Clear() { DrainEventFD(data_fd); }
+
+void PTYReader::Consume(std::size_t n) {
+  ring.Consume(n);
+  if (waiting.load())
+    SignalEventFD(wake_fd);
+}
+
+void PTYReader::Run() {
+  struct pollfd p[2] = {{wake_fd, POLLIN, 0}, {tty.getfd(), POLLIN, 0}};
+  std::size_t read_size = min_read;
+  bool readable = false; // the last read filled its buffer
+
+  while (!stop.load()) {
+    auto [buffer, room] = ring.WriteSpan();
+    if (!room) {
+      // The ring is full: wait for Consume, or for Stop
+      ++stalls;
+      waiting = true;
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (ring.size() == ring.capacity())
+        poll(p, 1, -1);
+      waiting = false;
+      DrainEventFD(wake_fd);
+      continue;
+    }
+
+    // During a flood, read again right away instead of polling first
+    if (!readable) {
+      if (poll(p, 2, -1) < 0)
+        continue;
+      if (p[0].revents & POLLIN)
+        DrainEventFD(wake_fd);
+      if (!(p[1].revents & (POLLIN | POLLHUP | POLLERR)))
+        continue;
+    }
+
+    std::size_t size = std::min(room, read_size);
+    auto [input, result] = tty.Recv(buffer, size);
+    if (result > 0) {
+      last_read = std::chrono::steady_clock::now().time_since_epoch().count();
+      ring.Commit(input.size());
+      ++reads;
+      bytes_read += input.size();
+      max_occupancy = std::max(max_occupancy.load(), ring.size());
+      SignalEventFD(data_fd);
+
+      // Read more at a time while the PTY keeps filling the reads
+      readable = input.size() == size;
+      if (readable && size == read_size)
+        read_size = std::min(read_size * 2, max_read);
+      else if (input.size() < read_size / 2)
+        read_size = std::max(read_size / 2, min_read);
+    } else if (result < 0 && (errno == EAGAIN || errno == EINTR)) {
+      readable = false;
+    } else {
+      closed = true;
+      SignalEventFD(data_fd);
+      return;
+    }
+  }
+}
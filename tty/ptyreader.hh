@@ -0,0 +1,68 @@
+#ifndef PTYREADER_H
+#define PTYREADER_H
+
+#include "bytering.hh"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <string_view>
+#include <thread>
+
+class ForkPTY;
+
+// Drains a PTY on its own thread into a ring, so that the child does not
+// block on a full kernel buffer while the main thread renders.
+//
+// getfd() becomes readable when input has arrived or the PTY was closed;
+// Clear() rearms it. The main thread then takes the input with Peek()
+// and Consume().
+class PTYReader {
+public:
+  explicit PTYReader(ForkPTY &tty, std::size_t capacity = 1u << 20);
+  PTYReader(const PTYReader &) = delete;
+  PTYReader &operator=(const PTYReader &) = delete;
+  ~PTYReader() { Stop(); }
+
+  // Stops the thread; must be called before the PTY is closed.
+  void Stop();
+
+  int getfd() const { return data_fd; }
+  void Clear();
+
+  std::string_view Peek() const { return ring.Peek(); }
+  void Consume(std::size_t n);
+
+  // Whether the PTY has reached end of file. Input may still be pending.
+  bool Closed() const { return closed.load(); }
+
+  // For tuning the ring size
+  std::size_t Occupancy() const { return ring.size(); }
+  std::size_t Capacity() const { return ring.capacity(); }
+  std::size_t MaxOccupancy() const { return max_occupancy.load(); }
+  std::size_t Stalls() const { return stalls.load(); } // ring was full
+  std::size_t BytesRead() const { return bytes_read.load(); }
+  std::size_t Reads() const { return reads.load(); }
+
+  // When input last arrived, for latency measurements
+  std::chrono::steady_clock::time_point LastRead() const {
+    return std::chrono::steady_clock::time_point(
+        std::chrono::steady_clock::duration(last_read.load()));
+  }
+
+private:
+  // Bounds of the adaptive read size
+  static constexpr std::size_t min_read = 4096, max_read = 64u << 10;
+
+  void Run();
+
+  ForkPTY &tty;
+  ByteRing ring;
+  int data_fd, wake_fd; // to the main thread, to the reader thread
+  std::atomic<bool> closed{false}, stop{false}, waiting{false};
+  std::atomic<std::size_t> max_occupancy{0}, stalls{0};
+  std::atomic<std::size_t> bytes_read{0}, reads{0};
+  std::atomic<std::chrono::steady_clock::rep> last_read{0};
+  std::thread thread;
+};
+
+#endif /* PTYREADER_H */
@@ -1,10 +1,330 @@
 #include "terminal.hh"
 #include "256color.hh"
 #include "ctype.hh"
+#include <algorithm>
 #include <array>
 #include <cstdio>
 #include <sstream>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Returns the length of the leading run of characters that the ground
+// state prints as-is, i.e. everything up to the next C0 control or DEL.
+static std::size_t PrintableRun(const char32_t *s, std::size_t length) {
+  std::size_t n = 0;
+#if defined(__AVX2__)
+  const __m256i space8 = _mm256_set1_epi32(0x20),
+                del8 = _mm256_set1_epi32(0x7F);
+  for (; n + 8 <= length; n += 8) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(s + n));
+    __m256i special = _mm256_or_si256(_mm256_cmpgt_epi32(space8, v),
+                                      _mm256_cmpeq_epi32(v, del8));
+    if (unsigned mask = _mm256_movemask_ps(_mm256_castsi256_ps(special)))
+      return n + __builtin_ctz(mask);
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i space4 = _mm_set1_epi32(0x20), del4 = _mm_set1_epi32(0x7F);
+  for (; n + 4 <= length; n += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(s + n));
+    __m128i special =
+        _mm_or_si128(_mm_cmplt_epi32(v, space4), _mm_cmpeq_epi32(v, del4));
+    if (unsigned mask = _mm_movemask_ps(_mm_castsi128_ps(special)))
+      return n + __builtin_ctz(mask);
+  }
+#endif
+  // Note: like the signed compares above, treat codepoints >= 2^31 as
+  // controls; the slow path prints them all the same.
+  for (; n < length; ++n)
+    if (std::int32_t(s[n]) < 0x20 || s[n] == 0x7F)
+      break;
+  return n;
+}
+
+// The same for UTF-8 input: also stops at the first non-ASCII byte.
+static std::size_t PrintableRun(const char *s, std::size_t length) {
+  std::size_t n = 0;
+#if defined(__AVX2__)
+  const __m256i space32 = _mm256_set1_epi8(0x20),
+                del32 = _mm256_set1_epi8(0x7F);
+  for (; n + 32 <= length; n += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(s + n));
+    // Signed compare: bytes >= 0x80 are negative
+    __m256i special = _mm256_or_si256(_mm256_cmpgt_epi8(space32, v),
+                                      _mm256_cmpeq_epi8(v, del32));
+    if (unsigned mask = _mm256_movemask_epi8(special))
+      return n + __builtin_ctz(mask);
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i space16 = _mm_set1_epi8(0x20), del16 = _mm_set1_epi8(0x7F);
+  for (; n + 16 <= length; n += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(s + n));
+    __m128i special =
+        _mm_or_si128(_mm_cmplt_epi8(v, space16), _mm_cmpeq_epi8(v, del16));
+    if (unsigned mask = _mm_movemask_epi8(special))
+      return n + __builtin_ctz(mask);
+  }
+#endif
+  for (; n < length; ++n)
+    if ((signed char)s[n] < 0x20 || s[n] == 0x7F)
+      break;
+  return n;
+}
+
+namespace {
+enum States : unsigned char {
+  st_default,
+  st_esc,
+  st_scs0,        // esc (
+  st_scs1,        // esc )
+  st_scr,         // esc #
+  st_esc_percent, // esc %
+  st_csi,         // esc [
+  st_csi_dec,     // csi ?
+  st_csi_dec2,    // csi >
+  st_csi_dec3,    // csi =
+  st_csi_ex,      // csi !
+  //
+  st_num_states
+};
+
+// Character classes, after the DEC ANSI parser model. Codepoints >= 0x80
+// are always cl_other and never reach the tables.
+enum Classes : unsigned char {
+  cl_other, // no function of its own: printed in the ground state
+  cl_bel,
+  cl_bs,
+  cl_ht,
+  cl_lf, // LF, VT, FF
+  cl_cr,
+  cl_so,
+  cl_si,
+  cl_can, // CAN, SUB
+  cl_esc,
+  cl_del,
+  cl_inter,   // 0x20..0x2F except '!', and '<'
+  cl_digit,   // 0..9
+  cl_sep,     // : ;
+  cl_private, // ? > = !
+  cl_final,   // 0x40..0x7E
+  //
+  cl_num_classes
+};
+
+enum Actions : unsigned char {
+  ac_print,
+  ac_ground, // cancel the sequence
+  ac_ignore,
+  ac_bel,
+  ac_bs,
+  ac_ht,
+  ac_lf,
+  ac_cr,
+  ac_so,
+  ac_si,
+  ac_esc,
+  ac_param,
+  ac_sep,
+  ac_private,
+  ac_esc_dispatch,
+  ac_csi_dispatch
+};
+
+enum EscOps : unsigned char {
+  esc_none,
+  esc_scs0,    // esc (
+  esc_scs1,    // esc )
+  esc_scr,     // esc #
+  esc_csi,     // esc [
+  esc_percent, // esc %
+  esc_nel,     // esc E
+  esc_ri,      // esc M
+  esc_ris,     // esc c
+  esc_decsc,   // esc 7
+  esc_decrc,   // esc 8
+  esc_decid,   // esc Z
+  esc_g0,      // esc ( B, 0, U, K
+  esc_g1,      // esc ) B, 0, U, K
+  esc_decaln,  // esc # 8
+  esc_utf_off, // esc % @
+  esc_utf_on   // esc % G, esc % 8
+};
+
+enum CsiOps : unsigned char {
+  csi_none,
+  csi_scosc,        // csi s
+  csi_scorc,        // csi u
+  csi_cha,          // csi G, csi `
+  csi_vpa,          // csi d
+  csi_cpl,          // csi F
+  csi_cuu,          // csi A
+  csi_cnl,          // csi E
+  csi_cud,          // csi B, csi e
+  csi_cuf,          // csi C, csi a
+  csi_cub,          // csi D
+  csi_cup,          // csi H, csi f
+  csi_ed,           // csi J
+  csi_el,           // csi K
+  csi_il,           // csi L
+  csi_dl,           // csi M
+  csi_su,           // csi S
+  csi_sd_or_mouse,  // csi T
+  csi_sd,           // csi ^
+  csi_dch,          // csi P
+  csi_ech,          // csi X
+  csi_ich,          // csi @
+  csi_decstbm,      // csi r, csi ! p
+  csi_dsr,          // csi n
+  csi_da1,          // csi c
+  csi_da2,          // csi > c
+  csi_da3,          // csi = c
+  csi_decset,       // csi ? h, csi ? l
+  csi_rep,          // csi b
+  csi_sgr           // csi m
+};
+
+constexpr std::array<unsigned char, 0x80> MakeClasses() {
+  std::array<unsigned char, 0x80> result = {};
+  for (unsigned c = 0x20; c < 0x30; ++c)
+    result[c] = cl_inter;
+  for (unsigned c = U'0'; c <= U'9'; ++c)
+    result[c] = cl_digit;
+  for (unsigned c = 0x40; c < 0x7F; ++c)
+    result[c] = cl_final;
+  result[U':'] = result[U';'] = cl_sep;
+  result[U'<'] = cl_inter;
+  result[U'?'] = result[U'>'] = result[U'='] = result[U'!'] = cl_private;
+  result[U'\7'] = cl_bel;
+  result[U'\b'] = cl_bs;
+  result[U'\t'] = cl_ht;
+  result[10] = result[11] = result[12] = cl_lf;
+  result[U'\r'] = cl_cr;
+  result[U'\16'] = cl_so;
+  result[U'\17'] = cl_si;
+  result[U'\30'] = result[U'\32'] = cl_can;
+  result[U'\33'] = cl_esc;
+  result[U'\177'] = cl_del;
+  return result;
+}
+
+constexpr std::array<std::array<unsigned char, cl_num_classes>, st_num_states>
+MakeTransitions() {
+  std::array<std::array<unsigned char, cl_num_classes>, st_num_states> result =
+      {};
+  for (unsigned st = 0; st < st_num_states; ++st) {
+    auto &t = result[st];
+    bool ground = st == st_default, csi = st >= st_csi;
+    for (unsigned cl = 0; cl < cl_num_classes; ++cl)
+      t[cl] = ground ? ac_print : csi ? ac_ground : ac_esc_dispatch;
+    t[cl_other] = ground ? ac_print : ac_ground;
+    t[cl_esc] = ground ? ac_esc : ac_ground;
+    if (csi) {
+      t[cl_digit] = ac_param;
+      t[cl_sep] = ac_sep;
+      t[cl_private] = st == st_csi ? ac_private : ac_ground;
+      t[cl_final] = ac_csi_dispatch;
+    }
+    // Note: These are recognized even in the middle of an ANSI/VT code.
+    t[cl_bel] = ac_bel;
+    t[cl_bs] = ac_bs;
+    t[cl_ht] = ac_ht;
+    t[cl_lf] = ac_lf;
+    t[cl_cr] = ac_cr;
+    t[cl_so] = ac_so;
+    t[cl_si] = ac_si;
+    t[cl_can] = ac_ground;
+    t[cl_del] = ac_ignore;
+  }
+  return result;
+}
+
+// Indexed by [state - st_esc][c - 0x20]
+constexpr std::array<std::array<unsigned char, 0x5F>, st_csi - st_esc>
+MakeEscOps() {
+  std::array<std::array<unsigned char, 0x5F>, st_csi - st_esc> result = {};
+  auto set = [&](unsigned st, char32_t c, unsigned char op) {
+    result[st - st_esc][c - 0x20] = op;
+  };
+  set(st_esc, U'(', esc_scs0);
+  set(st_esc, U')', esc_scs1);
+  set(st_esc, U'#', esc_scr);
+  set(st_esc, U'[', esc_csi);
+  set(st_esc, U'%', esc_percent);
+  set(st_esc, U'E', esc_nel);
+  set(st_esc, U'M', esc_ri);
+  set(st_esc, U'c', esc_ris);
+  set(st_esc, U'7', esc_decsc);
+  set(st_esc, U'8', esc_decrc);
+  set(st_esc, U'Z', esc_decid);
+  for (char32_t c : {U'B', U'0', U'U', U'K'}) {
+    set(st_scs0, c, esc_g0);
+    set(st_scs1, c, esc_g1);
+  }
+  set(st_scr, U'8', esc_decaln);
+  set(st_esc_percent, U'@', esc_utf_off);
+  set(st_esc_percent, U'G', esc_utf_on);
+  set(st_esc_percent, U'8', esc_utf_on);
+  return result;
+}
+
+// Indexed by [state - st_csi][c - 0x40]
+constexpr std::array<std::array<unsigned char, 0x3F>, st_num_states - st_csi>
+MakeCsiOps() {
+  std::array<std::array<unsigned char, 0x3F>, st_num_states - st_csi> result =
+      {};
+  auto set = [&](unsigned st, char32_t c, unsigned char op) {
+    result[st - st_csi][c - 0x40] = op;
+  };
+  set(st_csi, U's', csi_scosc);
+  set(st_csi, U'u', csi_scorc);
+  set(st_csi, U'G', csi_cha);
+  set(st_csi, U'`', csi_cha);
+  set(st_csi, U'd', csi_vpa);
+  set(st_csi, U'F', csi_cpl);
+  set(st_csi, U'A', csi_cuu);
+  set(st_csi, U'E', csi_cnl);
+  set(st_csi, U'e', csi_cud);
+  set(st_csi, U'B', csi_cud);
+  set(st_csi, U'a', csi_cuf);
+  set(st_csi, U'C', csi_cuf);
+  set(st_csi, U'D', csi_cub);
+  set(st_csi, U'H', csi_cup);
+  set(st_csi, U'f', csi_cup);
+  set(st_csi, U'J', csi_ed);
+  set(st_csi, U'K', csi_el);
+  set(st_csi, U'L', csi_il);
+  set(st_csi, U'M', csi_dl);
+  set(st_csi, U'S', csi_su);
+  set(st_csi, U'T', csi_sd_or_mouse);
+  set(st_csi, U'^', csi_sd);
+  set(st_csi, U'P', csi_dch);
+  set(st_csi, U'X', csi_ech);
+  set(st_csi, U'@', csi_ich);
+  set(st_csi, U'r', csi_decstbm);
+  set(st_csi_ex, U'p', csi_decstbm);
+  set(st_csi, U'n', csi_dsr);
+  set(st_csi, U'c', csi_da1);
+  set(st_csi_dec2, U'c', csi_da2);
+  set(st_csi_dec3, U'c', csi_da3);
+  set(st_csi_dec, U'h', csi_decset);
+  set(st_csi_dec, U'l', csi_decset);
+  set(st_csi, U'b', csi_rep);
+  set(st_csi, U'm', csi_sgr);
+  // csi g (tab stops), csi q (leds) and csi h/l (ansi modes) are ignored
+  return result;
+}
+
+constexpr auto classes = MakeClasses();
+constexpr auto transitions = MakeTransitions();
+constexpr auto esc_ops = MakeEscOps();
+constexpr auto csi_ops = MakeCsiOps();
+} // namespace
+
 void termwindow::Reset() {
   cx = cy = top = 0;
   bottom = wnd.ysize - 1;
@@ -71,27 +391,20 @@ void termwindow::yscroll_down(unsigned y1, unsigned y2, int amount) const {
   unsigned hei = y2 - y1 + 1;
   if (unsigned(amount) > hei)
     amount = hei;
-
-  fprintf(stderr, "Height = %d, amount = %d, scrolling DOWN by %d lines\n", hei,
-          amount, hei - amount);
-  wnd.copytext(0, y1 + amount, 0, y1, wnd.xsize, hei - amount);
-  wnd.fillbox(0, y1, wnd.xsize, amount);
+  wnd.ScrollDown(y1, y2, amount);
 }
 
-void termwindow::yscroll_up(unsigned y1, unsigned y2, int amount) const {
+void termwindow::yscroll_up(unsigned y1, unsigned y2, int amount,
+                            bool save) const {
   unsigned hei = y2 - y1 + 1;
   if (unsigned(amount) > hei)
     amount = hei;
-
-  fprintf(stderr, "Height = %d, amount = %d, scrolling UP by %d lines\n", hei,
-          amount, hei - amount);
-  wnd.copytext(0, y1, 0, y1 + amount, wnd.xsize, hei - amount);
-  wnd.fillbox(0, y2 - amount + 1, wnd.xsize, amount);
+  wnd.ScrollUp(y1, y2, amount, save);
 }
 
 void termwindow::Lf() {
   if (cy >= bottom) {
-    yscroll_up(top, bottom, 1);
+    yscroll_up(top, bottom, 1, true);
   } else {
     ++cy;
   }
@@ -102,757 +415,728 @@ void termwindow::ResetFG() { wnd.blank.fgcolor = xterm256table[7]; }
 void termwindow::ResetBG() { wnd.blank.bgcolor = xterm256table[0]; }
 
 void termwindow::ResetAttr() {
-  wnd.blank = Cell{};
+  wnd.blank = Style{};
   ResetFG();
   ResetBG();
 }
 
 void termwindow::EchoBack(std::u32string_view buffer) {
-  OutBuffer.insert(OutBuffer.end(), buffer.begin(), buffer.end());
+  OutBuffer.Push(buffer);
+}
+
+template <typename CharT>
+void termwindow::PutText(const CharT *text, std::size_t length) {
+  while (length) {
+    ScrollFix();
+    std::size_t m = std::min(length, wnd.xsize - cx);
+    wnd.PutText(cx, cy, text, m);
+    cx += m;
+    text += m;
+    length -= m;
+  }
 }
 
 void termwindow::Write(std::u32string_view s) {
-  enum States : unsigned {
-    st_default,
-    st_esc,
-    st_scs0,        // esc (
-    st_scs1,        // esc )
-    st_scr,         // esc #
-    st_esc_percent, // esc %
-    st_csi,         // esc [
-    st_csi_dec,     // csi ?
-    st_csi_dec2,    // csi >
-    st_csi_dec3,    // csi =
-    st_csi_ex,      // csi !
-    //
-    st_num_states
-  };
+  chars_parsed += s.size();
+  Parse(s);
+  SyncCursor();
+}
 
-  auto GetParams = [&](unsigned min_params, bool change_zero_to_one) {
-    if (p.size() < min_params) {
-      p.resize(min_params);
+void termwindow::Write(std::string_view s) {
+  chars_parsed += s.size();
+  for (std::size_t pos = 0; pos < s.size();) {
+    if (state == st_default && !decoder.Pending()) {
+      // Plain ASCII goes straight from the read buffer into cells.
+      std::size_t n = PrintableRun(&s[pos], s.size() - pos);
+      PutText(&s[pos], n);
+      if ((pos += n) == s.size())
+        break;
     }
-    if (change_zero_to_one)
-      for (auto &v : p)
-        if (!v)
-          v = 1;
-    state = st_default;
-  };
 
-  unsigned color = 0;
-  auto State = [](char32_t c, unsigned st) constexpr {
-    return c * st_num_states + st;
-  };
-
-  for (char32_t c : s)
-    switch (State(c, state)) {
-#define CsiState(c)                                                            \
-  State(c, st_csi)                                                             \
-      : case State(c, st_csi_dec2)                                             \
-      : case State(c, st_csi_dec)                                              \
-      : case State(c, st_csi_dec3) : case State(c, st_csi_ex)
-#define AnyState(c)                                                            \
-  State(c, st_default)                                                         \
-      : case State(c, st_esc)                                                  \
-      : case State(c, st_scs0)                                                 \
-      : case State(c, st_scs1)                                                 \
-      : case State(c, st_scr)                                                  \
-      : case State(c, st_esc_percent) : case CsiState(c)
-
-      // Note: These escapes are recognized even in the middle of an ANSI/VT
-      // code.
-    case AnyState(U'\7'): {
-      lastch = c;
-      // BeepOn();
-      break;
-    }
-    case AnyState(U'\b'): {
-      lastch = c;
-      ScrollFix();
-      if (cx > 0) {
-        --cx;
-      }
-      break;
+    if ((unsigned char)s[pos] < 0x80 && !decoder.Pending()) {
+      Feed(s[pos++]);
+      continue;
     }
-    case AnyState(U'\t'): {
-      lastch = c;
-      ScrollFix();
-      cx += 8 - (cx & 7);
-    cmov:
-      FixCoord();
-      break;
+
+    // Decode everything up to the next ASCII byte in one go. The decoder
+    // keeps a sequence that continues in the next read.
+    constexpr std::size_t max_run = 256;
+    char32_t decoded[max_run + 1];
+    std::size_t end = pos + 1;
+    while (end < s.size() && end - pos < max_run &&
+           (unsigned char)s[end] >= 0x80)
+      ++end;
+    Parse({decoded, decoder.Decode(s.substr(pos, end - pos), decoded)});
+    pos = end;
+  }
+  SyncCursor();
+}
+
+void termwindow::Parse(std::u32string_view s) {
+  for (std::size_t pos = 0; pos < s.size();) {
+    if (state == st_default) {
+      // Ground state fast path: commit whole runs of printable characters
+      // to the screen at once, wrapping at the right margin.
+      std::size_t n = PrintableRun(&s[pos], s.size() - pos);
+      PutText(&s[pos], n);
+      if ((pos += n) == s.size())
+        break;
     }
-    case AnyState(U'\r'): {
-      lastch = c;
-      cx = 0;
-      break;
+    Feed(s[pos++]);
+  }
+}
+
+void termwindow::SyncCursor() {
+  if ((cx + 1 != int(wnd.xsize) || cy + 1 != int(wnd.ysize))) {
+    wnd.cursx = cx;
+    wnd.cursy = cy;
+  }
+}
+
+void termwindow::Feed(char32_t c) {
+  unsigned cl = c < 0x80 ? classes[c] : unsigned(cl_other);
+  switch (transitions[state][cl]) {
+  case ac_print:
+    ScrollFix();
+    wnd.PutCh(cx, cy, c, translate);
+    ++cx;
+    break;
+  case ac_ground:
+    state = st_default;
+    break;
+  case ac_ignore: /* del - ignore */
+    break;
+  case ac_bel:
+    lastch = c;
+    // BeepOn();
+    break;
+  case ac_bs:
+    lastch = c;
+    ScrollFix();
+    if (cx > 0) {
+      --cx;
     }
-    case AnyState(U'\16'): {
-      activeset = 1;
+    break;
+  case ac_ht:
+    lastch = c;
+    ScrollFix();
+    cx += 8 - (cx & 7);
+    FixCoord();
+    break;
+  case ac_lf:
+    lastch = c;
+    ScrollFix();
+    Lf();
+    break;
+  case ac_cr:
+    lastch = c;
+    cx = 0;
+    break;
+  case ac_so:
+    activeset = 1;
+    translate = g1set;
+    break;
+  case ac_si:
+    activeset = 0;
+    translate = g0set;
+    break;
+  case ac_esc:
+    state = st_esc;
+    p.clear();
+    break;
+  case ac_param:
+    if (p.empty())
+      p.emplace_back();
+    p.back() = p.back() * 10u + (c - U'0');
+    break;
+  case ac_sep:
+    p.emplace_back();
+    break;
+  case ac_private: // csi ?, csi >, csi =, csi !
+    state = c == U'?'   ? st_csi_dec
+            : c == U'>' ? st_csi_dec2
+            : c == U'=' ? st_csi_dec3
+                        : st_csi_ex;
+    break;
+  case ac_esc_dispatch:
+    EscDispatch(esc_ops[state - st_esc][c - 0x20], c);
+    break;
+  case ac_csi_dispatch:
+    CsiDispatch(csi_ops[state - st_csi][c - 0x40], c);
+    break;
+  }
+}
+
+void termwindow::GetParams(unsigned min_params, bool change_zero_to_one) {
+  if (p.size() < min_params) {
+    p.resize(min_params);
+  }
+  if (change_zero_to_one)
+    for (auto &v : p)
+      if (!v)
+        v = 1;
+}
+
+void termwindow::EscDispatch(unsigned op, char32_t c) {
+  state = st_default;
+  switch (op) {
+  case esc_scs0:
+    state = st_scs0;
+    break;
+  case esc_scs1:
+    state = st_scs1;
+    break;
+  case esc_scr:
+    state = st_scr;
+    break;
+  case esc_csi:
+    state = st_csi;
+    break;
+  case esc_percent:
+    state = st_esc_percent;
+    break;
+  case esc_nel: // esc E = CR + LF
+    cx = 0;
+    lastch = c;
+    ScrollFix();
+    Lf();
+    break;
+  case esc_ri: // esc M, Ri (FIXME verify that this is right?)
+    /* Within window: move cursor up; scroll the window down if at top */
+    if (cy > top)
+      --cy;
+    else
+      yscroll_down(top, bottom, 1);
+    break;
+  case esc_ris:
+    Reset();
+    break;
+  case esc_decsc: // esc 7, csi s
+    save_cur();
+    break;
+  case esc_decrc: // esc 8, csi u
+    restore_cur();
+    break;
+  case esc_decid: // esc Z, same as csi c
+    CsiDispatch(csi_da1, c);
+    break;
+  case esc_g0: // esc ( B, esc ( 0, esc ( U, esc ( K
+    g0set = c == U'B' ? 0 : c == U'0' ? 1 : c == U'U' ? 2 : 3;
+    if (activeset == 0)
+      translate = g0set;
+    break;
+  case esc_g1: // esc ) B, esc ) 0, esc ) U, esc ) K
+    g1set = c == U'B' ? 0 : c == U'0' ? 1 : c == U'U' ? 2 : 3;
+    if (activeset == 1)
       translate = g1set;
+    break;
+  case esc_decaln: // clear screen with 'E' // esc # 8
+    wnd.fillbox(0, 0, wnd.xsize, wnd.ysize, wnd.Blank(U'E'));
+    break;
+  case esc_utf_off: // esc % @
+    utfmode = 0;
+    break;
+  case esc_utf_on: // esc % G, esc % 8
+    utfmode = 1;
+    break;
+  }
+}
+
+void termwindow::CsiDispatch(unsigned op, char32_t c) {
+  state = st_default;
+  switch (op) {
+  case csi_scosc:
+    save_cur();
+    break;
+  case csi_scorc:
+    restore_cur();
+    break;
+  case csi_cha: // absolute hpos
+    GetParams(1, true);
+    cx = p[0] - 1;
+    FixCoord();
+    break;
+  case csi_vpa: // absolute vpos
+    GetParams(1, true);
+    cy = p[0] - 1;
+    FixCoord();
+    break;
+  case csi_cpl:
+    cx = 0;
+    [[fallthrough]];
+  case csi_cuu:
+    GetParams(1, true);
+    cy -= p[0];
+    FixCoord();
+    break;
+  case csi_cnl:
+    cx = 0;
+    [[fallthrough]];
+  case csi_cud:
+    GetParams(1, true);
+    cy += p[0];
+    FixCoord();
+    break;
+  case csi_cuf:
+    GetParams(1, true);
+    cx += p[0];
+    FixCoord();
+    break;
+  case csi_cub:
+    GetParams(1, true);
+    cx -= p[0];
+    FixCoord();
+    break;
+  case csi_cup:
+    GetParams(2, true);
+    cx = p[1] - 1;
+    cy = p[0] - 1;
+    FixCoord();
+    break;
+  case csi_ed:
+    GetParams(1, false);
+    switch (p[0]) {
+    case 0: // erase from cursor to end of display
+      if (unsigned(cy) < wnd.ysize - 1)
+        wnd.fillbox(0, cy + 1, wnd.xsize, wnd.ysize - cy - 1);
+      goto clreol;
+    case 1: // erase from start to cursor
+      if (cy > 0)
+        wnd.fillbox(0, 0, wnd.xsize, cy);
+      goto clrbol;
+    case 2: // erase whole display
+      wnd.fillbox(0, 0, wnd.xsize, wnd.ysize);
       break;
     }
-    case AnyState(U'\17'): {
-      activeset = 0;
-      translate = g0set;
+    break;
+  case csi_el:
+    GetParams(1, false);
+    // 0: erase from cursor to end of line
+    // 1: erase from start of line to cursor
+    // 2: erase whole line
+    switch (p[0]) {
+    case 0:
+    clreol:
+      wnd.fillbox(cx, cy, wnd.xsize - cx, 1);
       break;
-    }
-    case AnyState(U'\177'): { /* del - ignore */
+    case 1:
+    clrbol:
+      wnd.fillbox(0, cy, cx + 1, 1);
       break;
-    }
-    case AnyState(U'\30'):
-      [[fallthrough]];
-    case AnyState(U'\32'): {
-    Ground:
-      state = st_default;
+    case 2:
+      wnd.fillbox(0, cy, wnd.xsize, 1);
       break;
     }
-    case State(U'\33', st_default):
-      state = st_esc;
-      p.clear();
-      break;
-    case State(U'(', st_esc):
-      state = st_scs0;
-      break; // esc (
-    case State(U')', st_esc):
-      state = st_scs1;
-      break; // esc )
-    case State(U'#', st_esc):
-      state = st_scr;
-      break; // esc #
-    case State(U'[', st_esc):
-      state = st_csi;
-      break; // esc [
-    case State(U'%', st_esc):
-      state = st_esc_percent;
-      break; // esc %
-    case State(U'?', st_csi):
-      state = st_csi_dec;
-      break; // csi ?
-    case State(U'>', st_csi):
-      state = st_csi_dec2;
-      break; // csi >
-    case State(U'=', st_csi):
-      state = st_csi_dec3;
-      break; // csi =
-    case State(U'!', st_csi):
-      state = st_csi_ex;
-      break; // csi !
-
-    case CsiState(U'0'):
-    case CsiState(U'1'):
-    case CsiState(U'2'):
-    case CsiState(U'3'):
-    case CsiState(U'4'):
-    case CsiState(U'5'):
-    case CsiState(U'6'):
-    case CsiState(U'7'):
-    case CsiState(U'8'):
-    case CsiState(U'9'):
-      if (p.empty())
-        p.emplace_back();
-      p.back() = p.back() * 10u + (c - U'0');
-      break;
-    case CsiState(U':'):
-    case CsiState(U';'):
-      p.emplace_back();
+    break;
+  case csi_il:
+    GetParams(1, true);
+    // scroll the rest of window c lines down,
+    // including where cursor is. Don't move cursor.
+    yscroll_down(cy, bottom, p[0]);
+    break;
+  case csi_dl:
+    GetParams(1, true);
+    yscroll_up(cy, bottom, p[0]);
+    break;
+  case csi_su: // xterm version?
+    GetParams(1, true);
+    yscroll_up(top, bottom, p[0], true);
+    break;
+  case csi_sd_or_mouse: // csi T, track mouse
+    if (p.size() > 1 || p.empty() || p[0] == 0) {
+      // mouse track
       break;
-
-    case State(U'E', st_esc): // esc E = CR + LF
-      cx = 0;
-      state = st_default;
-      [[fallthrough]];
-    case AnyState(10):
-    case AnyState(11):
-    case AnyState(12):
-      lastch = c;
-      ScrollFix();
-      Lf();
-      break;
-
-    case State(U'M', st_esc): // esc M, Ri (FIXME verify that this is right?)
-      /* Within window: move cursor up; scroll the window down if at top */
-      if (cy > top)
-        --cy;
-      else
-        yscroll_down(top, bottom, 1);
-      goto Ground;
-    case State(U'c', st_esc):
-      Reset();
-      break; // esc c
-    case State(U'7', st_esc):
-      [[fallthrough]]; // esc 7, csi s
-    case State(U's', st_csi):
-      save_cur();
-      goto Ground;
-    case State(U'8', st_esc):
-      [[fallthrough]]; // esc 8, csi u
-    case State(U'u', st_csi):
-      restore_cur();
-      goto Ground;
-    case State(U'B', st_scs0): // esc ( B
-      g0set = 0;
-    ActG0:
-      if (activeset == 0)
-        translate = g0set;
-      goto Ground;
-    case State(U'0', st_scs0):
-      g0set = 1;
-      goto ActG0; // esc ( 0
-    case State(U'U', st_scs0):
-      g0set = 2;
-      goto ActG0; // esc ( U
-    case State(U'K', st_scs0):
-      g0set = 3;
-      goto ActG0;              // esc ( K
-    case State(U'B', st_scs1): // esc ) B
-      g1set = 0;
-    ActG1:
-      if (activeset == 1)
-        translate = g1set;
-      goto Ground;
-    case State(U'0', st_scs1):
-      g1set = 1;
-      goto ActG1; // esc ) 0
-    case State(U'U', st_scs1):
-      g1set = 2;
-      goto ActG1; // esc ) U
-    case State(U'K', st_scs1):
-      g1set = 3;
-      goto ActG1;             // esc ) K
-    case State(U'8', st_scr): // clear screen with 'E' // esc # 8
-      wnd.blank.ch = U'E';
-      wnd.fillbox(0, 0, wnd.xsize, wnd.ysize);
-      wnd.blank.ch = U' ';
-      goto Ground;
-    case State(U'@', st_esc_percent):
-      utfmode = 0;
-      goto Ground; // esc % @
-    case State(U'G', st_esc_percent):
-      [[fallthrough]]; // esc % G
-    case State(U'8', st_esc_percent):
-      utfmode = 1;
-      goto Ground;            // esc % 8
-    case State(U'g', st_csi): /* TODO: set tab stops */
-      goto Ground;
-    case State(U'q', st_csi): /* TODO: set leds */
-      goto Ground;
-    case State(U'G', st_csi):
-      [[fallthrough]];
-    case State(U'`', st_csi): { // absolute hpos
-      GetParams(1, true);
-      cx = p[0] - 1;
-      goto cmov;
     }
-    case State(U'd', st_csi): { // absolute vpos
-      GetParams(1, true);
-      cy = p[0] - 1;
-      goto cmov;
+    [[fallthrough]];
+  case csi_sd: // csi ^, scroll down
+    GetParams(1, true);
+    // Reverse scrolling by N lines
+    // scroll the entire of window c lines down. Don't move cursor.
+    yscroll_down(top, bottom, p[0]);
+    break;
+  case csi_dch: {
+    GetParams(1, true);
+    unsigned n = p[0];
+    // insert n black holes at cursor (eat n characters
+    // and scroll line horizontally to left)
+    if (cx + n > wnd.xsize)
+      n = wnd.xsize - cx;
+    if (n) {
+      unsigned remain = wnd.xsize - (cx + n);
+      wnd.copytext(cx, cy, wnd.xsize - remain, cy, remain, 1);
+      wnd.fillbox(wnd.xsize - n, cy, n, 1);
     }
-    case State(U'F', st_csi):
-      cx = 0;
-      [[fallthrough]];
-    case State(U'A', st_csi): {
-      GetParams(1, true);
-      cy -= p[0];
-      goto cmov;
+    break;
+  }
+  case csi_ech:
+    GetParams(1, true);
+    // write n spaces at cursor (overwrite)
+    wnd.fillbox(cx, cy, std::min<std::size_t>(p[0], wnd.xsize - cx), 1);
+    break;
+  case csi_ich: {
+    GetParams(1, true);
+    unsigned n = p[0];
+    // insert n spaces at cursor
+    if (cx + n > wnd.xsize)
+      n = wnd.xsize - cx;
+    if (n) {
+      unsigned remain = wnd.xsize - (cx + n);
+      wnd.copytext(cx + n, cy, cx, cy, remain, 1);
+      wnd.fillbox(cx, cy, n, 1);
     }
-    case State(U'E', st_csi):
+    break;
+  }
+  case csi_decstbm: // csi r, csi ! p
+    GetParams(2, false);
+    if (!p[0])
+      p[0] = 1;
+    if (!p[1])
+      p[1] = wnd.ysize;
+    if (p[0] < p[1] && p[1] <= wnd.ysize) {
+      top = p[0] - 1;
+      bottom = p[1] - 1;
       cx = 0;
-      [[fallthrough]];
-    case State(U'e', st_csi):
-      [[fallthrouth]];
-    case State(U'B', st_csi): {
-      GetParams(1, true);
-      cy += p[0];
-      goto cmov;
-    }
-    case State(U'a', st_csi):
-      [[fallthrouth]];
-    case State(U'C', st_csi): {
-      GetParams(1, true);
-      cx += p[0];
-      goto cmov;
-    }
-    case State(U'D', st_csi): {
-      GetParams(1, true);
-      cx -= p[0];
-      goto cmov;
-    }
-    case State(U'H', st_csi):
-      [[fallthrough]];
-    case State(U'f', st_csi): {
-      GetParams(2, true);
-      cx = p[1] - 1;
-      cy = p[0] - 1;
-      goto cmov;
+      cy = top;
+      FixCoord();
     }
-    case State(U'J', st_csi):
-      GetParams(1, false);
-      switch (p[0]) {
-      case 0: // erase from cursor to end of display
-        if (unsigned(cy) < wnd.ysize - 1)
-          wnd.fillbox(0, cy + 1, wnd.xsize, wnd.ysize - cy - 1);
-        goto clreol;
-      case 1: // erase from start to cursor
-        if (cy > 0)
-          wnd.fillbox(0, 0, wnd.xsize, cy);
-        goto clrbol;
-      case 2: // erase whole display
-        wnd.fillbox(0, 0, wnd.xsize, wnd.ysize);
-        break;
-      }
+    break;
+  case csi_dsr:
+    GetParams(1, false);
+    switch (p[0]) {
+      char Buf[32];
+    case 5:
+      EchoBack(U"\33[0n");
+      break;
+    case 6:
+      EchoBack(FromUTF8(
+          std::string_view{Buf, (std::size_t)std::sprintf(Buf, "\33[%d;%dR",
+                                                          cy + 1, cx + 1)}));
       break;
-    case State(U'K', st_csi):
-      GetParams(1, false);
-      // 0: erase from cursor to end of line
-      // 1: erase from start of line to cursor
-      // 2: erase whole line
-      switch (p[0]) {
-      case 0:
-      clreol:
-        wnd.fillbox(cx, cy, wnd.xsize - cx, 1);
+    }
+    break;
+  case csi_da3:          // csi = 0 c, Tertiary device attributes (printer?)
+    GetParams(1, false); // Tertiary device attributes (printer?)
+    // Example response: ^[P!|0^[ (backslash)
+    if (!p[0])
+      EchoBack(U"\33P!|00000000\x9C");
+    break;
+  case csi_da2: // csi > 0 c, Secondary device attributes (terminal)
+    GetParams(1, false);
+    // Example response: ^[[>41;330;0c (middle = firmware version)
+    if (!p[0])
+      EchoBack(U"\33[>1;1;0c");
+    break;
+  case csi_da1: // csi 0 c // Primary device attributes (host computer)
+    GetParams(1, false);
+    if (!p[0])
+      EchoBack(U"\33[?65;1;6;8;15;22c");
+    // Example response: ^[[?64;1;2;6;9;15;18;21;22c
+    // 1 = 132 columns, 2 = printer port, 4 = sixel extension,
+    // 6 = selective erase, 7 = DRCS, 8 = user-defines keys,
+    // 9 = national replacement charsets, 12 = SCS extension,
+    // 15 = technical charset, 18 = windowing capability,
+    // 21 = horiz scrolling, 22 = ansi color/vt525,
+    // 29 = ansi text locator, 23 = greek ext, 24 = turkish ext,
+    // 42 = latin2 cset, 44 = pcterm, 45 = softkeymap,
+    // 46 = ascii emulation,
+    // 62..69 = VT level (62 = VT200, 63 = VT300, 64 = VT400)
+    break;
+  case csi_decset: { // csi ? h, misc modes on; csi ? l, misc modes off
+    bool set = c == U'h';
+    // 1 = CKM, 2 = ANM, 3 = COLM, 4 = SCLM, 5 = SCNM, 6 = OM, 7 = AWM,
+    // 8 = ARM, 18 = PFF, 19 = PEX, 25 = TCEM, 40 = 132COLS, 42 = NRCM,
+    // 44 = MARGINBELL, ...
+    // 6 puts cursor at (0,0) both set,clear
+    // 25 enables/disables cursor visibility
+    // 40 enables/disables 80/132 mode (note: if enabled, RESET changes to one
+    // of these)
+    // 3 sets width at 132(enable), 80(disable) if "40" is enabled
+    // 5 = screenwide reverse color
+    GetParams(0, false);
+    for (auto a : p)
+      switch (a) {
+      case 6:
+        cx = cy = 0;
+        FixCoord();
         break;
-      case 1:
-      clrbol:
-        wnd.fillbox(0, cy, cx + 1, 1);
+      case 25:
+        wnd.cursorvis = set;
         break;
-      case 2:
-        wnd.fillbox(0, cy, wnd.xsize, 1);
+      case 3:
+        wnd.reverse = set;
         break;
       }
+    break;
+  }
+  case csi_rep:
+    GetParams(1, true);
+    // Repeat last printed character n times
+    for (unsigned m = std::min(p[0], unsigned(wnd.xsize * wnd.ysize)), n = 0;
+         n < m; ++n) {
+      ScrollFix();
+      wnd.PutCh(cx, cy, lastch, translate);
+      ++cx;
+    }
+    break;
+  case csi_sgr:
+    SetAttr();
+    break;
+  }
+}
+
+void termwindow::SetAttr() { // csi m (SGR)
+  unsigned c = 0, color = 0;
+  GetParams(1, false); // Make sure there is at least 1 param
+  auto mode = [](unsigned n) constexpr { // room for 22
+    return 68 + n - 3;
+  };
+  auto flag = [](unsigned c, unsigned n) constexpr { // room for 8
+    return 10 + (n - 2) + (c - 1) * 4;
+  };
+  for (auto a : p)
+    switch (c < 3 ? ((c && (a >= 2 && a <= 5)) ? flag(c, a) : a)
+                  : mode(c)) {
+    case 0:
+      ResetAttr();
+      c = 0;
       break;
-    case State(U'L', st_csi):
-      GetParams(1, true);
-      // scroll the rest of window c lines down,
-      // including where cursor is. Don't move cursor.
-      yscroll_down(cy, bottom, p[0]);
+    case 1:
+      wnd.blank.attr |= Style::bold;
+      c = 0;
       break;
-    case State(U'M', st_csi):
-      GetParams(1, true);
-      yscroll_up(cy, bottom, p[0]);
+    case 2:
+      wnd.blank.attr |= Style::dim;
+      c = 0;
       break;
-    case State(U'S', st_csi): // xterm version?
-      GetParams(1, true);
-      yscroll_up(top, bottom, p[0]);
+    case 3:
+      wnd.blank.attr |= Style::italic;
+      c = 0;
       break;
-    case State(U'T', st_csi): // csi T, track mouse
-      if (p.size() > 1 || p.empty() || p[0] == 0) {
-        // mouse track
-        goto Ground;
-      }
-      [[fallthrough]];
-    case State(U'^', st_csi): // csi ^, scroll down
-      GetParams(1, true);
-      // Reverse scrolling by N lines
-      // scroll the entire of window c lines down. Don't move cursor.
-      yscroll_down(top, bottom, p[0]);
-      break;
-    case State(U'P', st_csi):
-      GetParams(1, true);
-      c = p[0];
-      // insert c black holes at cursor (eat c characters
-      // and scroll line horizontally to left)
-      if (cx + c > wnd.xsize)
-        c = wnd.xsize - cx;
-      if (c) {
-        unsigned remain = wnd.xsize - (cx + c);
-        wnd.copytext(cx, cy, wnd.xsize - remain, cy, remain, 1);
-        wnd.fillbox(wnd.xsize - c, cy, c, 1);
-      }
+    case 4:
+      wnd.blank.attr |= Style::underline;
+      c = 0;
       break;
-    case State(U'X', st_csi):
-      GetParams(1, true);
-      // write c spaces at cursor (overwrite)
-      wnd.fillbox(cx, cy + top, p[0], 1);
-      break;
-    case State(U'@', st_csi):
-      GetParams(1, true);
-      c = p[0];
-      // insert c spaces at cursor
-      if (cx + c > wnd.xsize)
-        c = wnd.xsize - cx;
-      if (c) {
-        unsigned remain = wnd.xsize - (cx + c);
-        wnd.copytext(cx + c, cy, cx, cy, remain, 1);
-        wnd.fillbox(cx, cy, c, 1);
-      }
+    case 5:
+      wnd.blank.attr |= Style::blink;
+      c = 0;
       break;
-    case State(U'r', st_csi):
-      [[fallthrough]];           // CSI r
-    case State(U'p', st_csi_ex): // CSI ! p
-      GetParams(2, false);
-      if (!p[0])
-        p[0] = 1;
-      if (!p[1])
-        p[1] = wnd.ysize;
-      if (p[0] < p[1] && p[1] <= wnd.ysize) {
-        top = p[0] - 1;
-        bottom = p[1] - 1;
-        fprintf(stderr, "Create a window with top = %d, bottom = %d\n", top,
-                bottom);
-        cx = 0;
-        cy = top;
-        goto cmov;
-      }
+    case 7:
+      wnd.blank.attr |= Style::reverse;
+      c = 0;
       break;
-    case State(U'n', st_csi):
-      GetParams(1, false);
-      switch (p[0]) {
-        char Buf[32];
-      case 5:
-        EchoBack(U"\33[0n");
-        break;
-      case 6:
-        EchoBack(FromUTF8(
-            std::string_view{Buf, (std::size_t)std::sprintf(Buf, "\33[%d;%dR",
-                                                            cy + 1, cx + 1)}));
-        break;
-      }
+    case 8:
+      wnd.blank.attr |= Style::conceal;
+      c = 0;
+      break;
+    case 9:
+      wnd.blank.attr |= Style::overstrike;
+      c = 0;
       break;
-    case State(U'c',
-               st_csi_dec3): // csi = 0 c, Tertiary device attributes (printer?)
-      GetParams(1, false);   // Tertiary device attributes (printer?)
-      // Example response: ^[P!|0^[ (backslash)
-      if (!p[0])
-        EchoBack(U"\33P!|00000000\x9C");
-      break;
-    case State(
-        U'c',
-        st_csi_dec2): // csi > 0 c, Secondary device attributes (terminal)
-      GetParams(1, false);
-      // Example response: ^[[>41;330;0c (middle = firmware version)
-      if (!p[0])
-        EchoBack(U"\33[>1;1;0c");
-      break;
-    case State(U'Z', st_esc):
-      [[falthrough]]; // esc Z
-    case State(U'c',
-               st_csi): // csi 0 c // Primary device attributes (host computer)
-      GetParams(1, false);
-      if (!p[0])
-        EchoBack(U"\33[?65;1;6;8;15;22c");
-      // Example response: ^[[?64;1;2;6;9;15;18;21;22c
-      // 1 = 132 columns, 2 = printer port, 4 = sixel extension,
-      // 6 = selective erase, 7 = DRCS, 8 = user-defines keys,
-      // 9 = national replacement charsets, 12 = SCS extension,
-      // 15 = technical charset, 18 = windowing capability,
-      // 21 = horiz scrolling, 22 = ansi color/vt525,
-      // 29 = ansi text locator, 23 = greek ext, 24 = turkish ext,
-      // 42 = latin2 cset, 44 = pcterm, 45 = softkeymap,
-      // 46 = ascii emulation,
-      // 62..69 = VT level (62 = VT200, 63 = VT300, 64 = VT400)
-      break;
-    case State(U'h', st_csi_dec):   // csi ? h, misc modes on
-    case State(U'l', st_csi_dec): { // csi ? l, misc modes off
-      bool set = c == U'h';
-      // 1 = CKM, 2 = ANM, 3 = COLM, 4 = SCLM, 5 = SCNM, 6 = OM, 7 = AWM,
-      // 8 = ARM, 18 = PFF, 19 = PEX, 25 = TCEM, 40 = 132COLS, 42 = NRCM,
-      // 44 = MARGINBELL, ...
-      // 6 puts cursor at (0,0) both set,clear
-      // 25 enables/disables cursor visibility
-      // 40 enables/disables 80/132 mode (note: if enabled, RESET changes to one
-      // of these)
-      // 3 sets width at 132(enable), 80(disable) if "40" is enabled
-      // 5 = screenwide reverse color
-      GetParams(0, false);
-      for (auto a : p)
-        switch (a) {
-        case 6:
-          cx = cy = 0;
-          FixCoord();
-          break;
-        case 25:
-          wnd.cursorvis = set;
-          break;
-        case 3:
-          wnd.reverse = set;
-          break;
-        }
+    case 20:
+      wnd.blank.attr |= Style::fraktur;
+      c = 0;
       break;
-    }
-    case State(U'h', st_csi): // csi h, ansi modes on
-    case State(U'l', st_csi): // csi l, ansi modes off
-      goto Ground;
-    case State(U'b', st_csi):
-      GetParams(1, true);
-      // Repeat last printed character n times
-      for (unsigned m = std::min(p[0], unsigned(wnd.xsize * wnd.ysize)), c = 0;
-           c < m; ++c) {
-        ScrollFix();
-        wnd.PutCh(cx, cy, lastch, translate);
-        ++cx;
-      }
+    case 21:
+      wnd.blank.attr |= Style::underline2;
+      c = 0;
       break;
-    case State(U'm', st_csi): { // csi m (SGR)
-      GetParams(1, false);      // Make sure there is at least 1 param
+    case 22:
+      wnd.blank.attr &= ~Style::dim;
+      wnd.blank.attr &= ~Style::bold;
       c = 0;
-      auto mode = [](unsigned n) constexpr { // room for 22
-        return 68 + n - 3;
-      };
-      auto flag = [](unsigned c, unsigned n) constexpr { // room for 8
-        return 10 + (n - 2) + (c - 1) * 4;
-      };
-      for (auto a : p)
-        switch (c < 3 ? ((c && (a >= 2 && a <= 5)) ? flag(c, a) : a)
-                      : mode(c)) {
-        case 0:
-          ResetAttr();
-          c = 0;
-          break;
-        case 1:
-          wnd.blank.bold = true;
-          c = 0;
-          break;
-        case 2:
-          wnd.blank.dim = true;
-          c = 0;
-          break;
-        case 3:
-          wnd.blank.italic = true;
-          c = 0;
-          break;
-        case 4:
-          wnd.blank.underline = true;
-          c = 0;
-          break;
-        case 5:
-          wnd.blank.blink = true;
-          c = 0;
-          break;
-        case 7:
-          wnd.blank.reverse = true;
-          c = 0;
-          break;
-        case 8:
-          wnd.blank.conceal = true;
-          c = 0;
-          break;
-        case 9:
-          wnd.blank.overstrike = true;
-          c = 0;
-          break;
-        case 20:
-          wnd.blank.fraktur = true;
-          c = 0;
-          break;
-        case 21:
-          wnd.blank.underline2 = true;
-          c = 0;
-          break;
-        case 22:
-          wnd.blank.dim = false;
-          wnd.blank.bold = false;
-          c = 0;
-          break;
-        case 23:
-          wnd.blank.italic = false;
-          wnd.blank.fraktur = false;
-          c = 0;
-          break;
-        case 24:
-          wnd.blank.underline = false;
-          wnd.blank.underline2 = false;
-          c = 0;
-          break;
-        case 25:
-          wnd.blank.blink = false;
-          c = 0;
-          break;
-        case 27:
-          wnd.blank.reverse = false;
-          c = 0;
-          break;
-        case 28:
-          wnd.blank.conceal = false;
-          c = 0;
-          break;
-        case 29:
-          wnd.blank.overstrike = false;
-          c = 0;
-          break;
-        case 39:
-          wnd.blank.underline = false;
-          wnd.blank.underline2 = false;
-          ResetFG();
-          c = 0;
-          break; // Set default foreground color
-        case 49:
-          ResetBG();
-          c = 0;
-          break; // Set default background color
-        case 51:
-          wnd.blank.framed = true;
-          c = 0;
-          break;
-        case 52:
-          wnd.blank.encircled = true;
-          c = 0;
-          break;
-        case 53:
-          wnd.blank.overlined = true;
-          c = 0;
-          break;
-        case 54:
-          wnd.blank.framed = false;
-          wnd.blank.encircled = false;
-          c = 0;
-          break;
-        case 55:
-          wnd.blank.overlined = false;
-          c = 0;
-          break;
-        case 38:
-          c = 1;
-          break;
-        case 48:
-          c = 2;
-          break;
-        case flag(1, 4):
-          c = 3;
-          color = 0;
-          break; // 38;4
-        case flag(1, 3):
-          c = 4;
-          color = 0;
-          break; // 38;3
-        case flag(1, 2):
-          c = 5;
-          color = 0;
-          break; // 38;2
-        case flag(2, 4):
-          c = 6;
-          color = 0;
-          break; // 48;4
-        case flag(2, 3):
-          c = 7;
-          color = 0;
-          break; // 48;3
-        case flag(2, 2):
-          c = 8;
-          color = 0;
-          break; // 48;2
-        case flag(1, 5):
-          c = 22;
-          break; // 38;5
-        case flag(2, 5):
-          c = 23;
-          break;       // 48;5
-        case mode(3):  // color = (color << 8) + a; c+=6; break; // 38;4;n
-        case mode(4):  // color = (color << 8) + a; c+=6; break; // 38;3;n
-        case mode(5):  // color = (color << 8) + a; c+=6; break; // 38;2;n
-        case mode(6):  // color = (color << 8) + a; c+=6; break; // 48;4;n
-        case mode(7):  // color = (color << 8) + a; c+=6; break; // 48;3;n
-        case mode(8):  // color = (color << 8) + a; c+=6; break; // 48;2;n
-        case mode(9):  // color = (color << 8) + a; c+=6; break; // 38;4;#;n
-        case mode(10): // color = (color << 8) + a; c+=6; break; // 38;3;#;n
-        case mode(11): // color = (color << 8) + a; c+=6; break; // 38;2;#;n
-        case mode(12): // color = (color << 8) + a; c+=6; break; // 48;4;#;n
-        case mode(13): // color = (color << 8) + a; c+=6; break; // 48;3;#;n
-        case mode(14): // color = (color << 8) + a; c+=6; break; // 48;2;#;n
-        case mode(15): // color = (color << 8) + a; c+=6; break; // 38;4;#;#;n
-        case mode(18):
-          color = (color << 8) + a;
-          c += 6;
-          break; // 48;4;#;#;n
-        case 30:
-        case 31:
-        case 32:
-        case 33:
-        case 34:
-        case 35:
-        case 36:
-        case 37:
-          a -= 30;
-          a += 90 - 8;
-          [[fallthrough]];
-        case 90:
-        case 91:
-        case 92:
-        case 93:
-        case 94:
-        case 95:
-        case 96:
-        case 97:
-          a -= 90 - 8;
-          [[fallthrough]];
-        case mode(22):
-          color = 0;
-          a = xterm256table[a & 0xFF];
-          [[fallthrough]]; // 38;5;n
-        case mode(21):
-          // color = (color << 8) + a;
-          // wnd.blank.fgcolor = color;
-          // c = 0;
-          // break; // 38;4;#;#;#;n (TODO CMYK->RGB)
-        case mode(16):
-          // color = (color << 8) + a;
-          // wnd.blank.fgcolor = color;
-          // c = 0;
-          // break; // 38;3;#;#;n   (TODO CMY->RGB)
-        case mode(17):
-          color = (color << 8) + a;
-          wnd.blank.fgcolor = color;
-          c = 0;
-          break; // 38;2;#;#;n   (RGB24)
-        case 40:
-        case 41:
-        case 42:
-        case 43:
-        case 44:
-        case 45:
-        case 46:
-        case 47:
-          a -= 40;
-          a += 100 - 8;
-          [[fallthrough]];
-        case 100:
-        case 101:
-        case 102:
-        case 103:
-        case 104:
-        case 105:
-        case 106:
-        case 107:
-          a -= 100 - 8;
-          [[fallthrough]];
-        case mode(23):
-          color = 0;
-          a = xterm256table[a & 0xFF];
-          [[fallthrough]]; // 48;5;n
-        case mode(24):
-          // color = (color << 8) + a;
-          // wnd.blank.bgcolor = color;
-          // c = 0;
-          // break; // 48;4;#;#;#;n (TODO CMYK->RGB)
-        case mode(19):
-          // color = (color << 8) + a;
-          // wnd.blank.bgcolor = color;
-          // c = 0;
-          // break; // 48;3;#;#;n   (TODO CMY->RGB)
-        case mode(20):
-          color = (color << 8) + a;
-          wnd.blank.bgcolor = color;
-          c = 0;
-          break; // 48;2;#;#;n   (RGB24)
-        default:
-          c = 0;
-          break;
-        }
       break;
-    }
+    case 23:
+      wnd.blank.attr &= ~Style::italic;
+      wnd.blank.attr &= ~Style::fraktur;
+      c = 0;
+      break;
+    case 24:
+      wnd.blank.attr &= ~Style::underline;
+      wnd.blank.attr &= ~Style::underline2;
+      c = 0;
+      break;
+    case 25:
+      wnd.blank.attr &= ~Style::blink;
+      c = 0;
+      break;
+    case 27:
+      wnd.blank.attr &= ~Style::reverse;
+      c = 0;
+      break;
+    case 28:
+      wnd.blank.attr &= ~Style::conceal;
+      c = 0;
+      break;
+    case 29:
+      wnd.blank.attr &= ~Style::overstrike;
+      c = 0;
+      break;
+    case 39:
+      wnd.blank.attr &= ~Style::underline;
+      wnd.blank.attr &= ~Style::underline2;
+      ResetFG();
+      c = 0;
+      break; // Set default foreground color
+    case 49:
+      ResetBG();
+      c = 0;
+      break; // Set default background color
+    case 51:
+      wnd.blank.attr |= Style::framed;
+      c = 0;
+      break;
+    case 52:
+      wnd.blank.attr |= Style::encircled;
+      c = 0;
+      break;
+    case 53:
+      wnd.blank.attr |= Style::overlined;
+      c = 0;
+      break;
+    case 54:
+      wnd.blank.attr &= ~Style::framed;
+      wnd.blank.attr &= ~Style::encircled;
+      c = 0;
+      break;
+    case 55:
+      wnd.blank.attr &= ~Style::overlined;
+      c = 0;
+      break;
+    case 38:
+      c = 1;
+      break;
+    case 48:
+      c = 2;
+      break;
+    case flag(1, 4):
+      c = 3;
+      color = 0;
+      break; // 38;4
+    case flag(1, 3):
+      c = 4;
+      color = 0;
+      break; // 38;3
+    case flag(1, 2):
+      c = 5;
+      color = 0;
+      break; // 38;2
+    case flag(2, 4):
+      c = 6;
+      color = 0;
+      break; // 48;4
+    case flag(2, 3):
+      c = 7;
+      color = 0;
+      break; // 48;3
+    case flag(2, 2):
+      c = 8;
+      color = 0;
+      break; // 48;2
+    case flag(1, 5):
+      c = 22;
+      break; // 38;5
+    case flag(2, 5):
+      c = 23;
+      break;       // 48;5
+    case mode(3):  // color = (color << 8) + a; c+=6; break; // 38;4;n
+    case mode(4):  // color = (color << 8) + a; c+=6; break; // 38;3;n
+    case mode(5):  // color = (color << 8) + a; c+=6; break; // 38;2;n
+    case mode(6):  // color = (color << 8) + a; c+=6; break; // 48;4;n
+    case mode(7):  // color = (color << 8) + a; c+=6; break; // 48;3;n
+    case mode(8):  // color = (color << 8) + a; c+=6; break; // 48;2;n
+    case mode(9):  // color = (color << 8) + a; c+=6; break; // 38;4;#;n
+    case mode(10): // color = (color << 8) + a; c+=6; break; // 38;3;#;n
+    case mode(11): // color = (color << 8) + a; c+=6; break; // 38;2;#;n
+    case mode(12): // color = (color << 8) + a; c+=6; break; // 48;4;#;n
+    case mode(13): // color = (color << 8) + a; c+=6; break; // 48;3;#;n
+    case mode(14): // color = (color << 8) + a; c+=6; break; // 48;2;#;n
+    case mode(15): // color = (color << 8) + a; c+=6; break; // 38;4;#;#;n
+    case mode(18):
+      color = (color << 8) + a;
+      c += 6;
+      break; // 48;4;#;#;n
+    case 30:
+    case 31:
+    case 32:
+    case 33:
+    case 34:
+    case 35:
+    case 36:
+    case 37:
+      a -= 30;
+      a += 90 - 8;
+      [[fallthrough]];
+    case 90:
+    case 91:
+    case 92:
+    case 93:
+    case 94:
+    case 95:
+    case 96:
+    case 97:
+      a -= 90 - 8;
+      [[fallthrough]];
+    case mode(22):
+      color = 0;
+      a = xterm256table[a & 0xFF];
+      [[fallthrough]]; // 38;5;n
+    case mode(21):
+      // color = (color << 8) + a;
+      // wnd.blank.fgcolor = color;
+      // c = 0;
+      // break; // 38;4;#;#;#;n (TODO CMYK->RGB)
+    case mode(16):
+      // color = (color << 8) + a;
+      // wnd.blank.fgcolor = color;
+      // c = 0;
+      // break; // 38;3;#;#;n   (TODO CMY->RGB)
+    case mode(17):
+      color = (color << 8) + a;
+      wnd.blank.fgcolor = color;
+      c = 0;
+      break; // 38;2;#;#;n   (RGB24)
+    case 40:
+    case 41:
+    case 42:
+    case 43:
+    case 44:
+    case 45:
+    case 46:
+    case 47:
+      a -= 40;
+      a += 100 - 8;
+      [[fallthrough]];
+    case 100:
+    case 101:
+    case 102:
+    case 103:
+    case 104:
+    case 105:
+    case 106:
+    case 107:
+      a -= 100 - 8;
+      [[fallthrough]];
+    case mode(23):
+      color = 0;
+      a = xterm256table[a & 0xFF];
+      [[fallthrough]]; // 48;5;n
+    case mode(24):
+      // color = (color << 8) + a;
+      // wnd.blank.bgcolor = color;
+      // c = 0;
+      // break; // 48;4;#;#;#;n (TODO CMYK->RGB)
+    case mode(19):
+      // color = (color << 8) + a;
+      // wnd.blank.bgcolor = color;
+      // c = 0;
+      // break; // 48;3;#;#;n   (TODO CMY->RGB)
+    case mode(20):
+      color = (color << 8) + a;
+      wnd.blank.bgcolor = color;
+      c = 0;
+      break; // 48;2;#;#;n   (RGB24)
     default:
-      if (state != st_default)
-        goto Ground;
-      ScrollFix();
-      wnd.PutCh(cx, cy, c, translate);
-      ++cx;
+      c = 0;
       break;
     }
-#undef AnyState
-
-  if ((cx + 1 != int(wnd.xsize) || cy + 1 != int(wnd.ysize))) {
-    wnd.cursx = cx;
-    wnd.cursy = cy;
-  }
 }
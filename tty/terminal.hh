@@ -1,8 +1,9 @@
 #ifndef TERMINAL_H
 #define TERMINAL_H
 
+#include "ctype.hh"
+#include "outputqueue.hh"
 #include "screen.hh"
-#include <deque>
 #include <string>
 
 class termwindow {
@@ -14,6 +15,7 @@ public:
 
   void EchoBack(std::u32string_view buffer);
   void Write(std::u32string_view s);
+  void Write(std::string_view s); // UTF-8
 
 private:
   void Reset();
@@ -24,16 +26,28 @@ private:
   void ScrollFix();
   void FixCoord();
   void yscroll_down(unsigned y1, unsigned y2, int amount) const;
-  void yscroll_up(unsigned y1, unsigned y2, int amount) const;
+  void yscroll_up(unsigned y1, unsigned y2, int amount,
+                  bool save = false) const;
 
   void Lf();
 
+  void Parse(std::u32string_view s);
+  void Feed(char32_t c);
+  template <typename CharT> void PutText(const CharT *text, std::size_t length);
+  void SyncCursor();
+
   void ResetFG();
   void ResetBG();
   void ResetAttr();
+  void SetAttr();
+
+  void GetParams(unsigned min_params, bool change_zero_to_one);
+  void EscDispatch(unsigned op, char32_t c);
+  void CsiDispatch(unsigned op, char32_t c);
 
 public:
-  std::deque<char32_t> OutBuffer;
+  OutputQueue OutBuffer; // replies, and keystrokes from the caller
+  std::uint64_t chars_parsed = 0; // given to Write; bytes for UTF-8
   int cx, cy;
 
 private:
@@ -42,15 +56,14 @@ private:
   int top, bottom;
   char g0set, g1set, activeset, utfmode, translate;
   char32_t lastch = U' ';
-  unsigned utflength;
-  unsigned long utfvalue;
+  UTF8Decoder decoder;
 
   std::vector<unsigned> p;
   unsigned state = 0;
 
   struct backup {
     int cx, cy, top, bottom;
-    Cell attr;
+    Style attr;
   } backup;
 
   std::u32string buf{};